@@ -10,6 +10,11 @@
 #include <linux/input-event-codes.h> // EV_*, KEY_*, ABS_*, SYN_*, REL_*, BTN_LEFT
 #include <linux/uinput.h> // uinput specific definitions (UI_SET_EVBIT, etc.)
 #include <sys/ioctl.h>  // ioctl
+#include <stdint.h>     // uint32_t, uint64_t
+#include <signal.h>     // sigaction, SIGINT, SIGTERM, SIGUSR1
+#include <sys/syscall.h> // __NR_perf_event_open
+#include <linux/perf_event.h> // struct perf_event_attr, PERF_COUNT_*, PERF_EVENT_IOC_*
+#include <sys/mman.h>   // mmap, munmap (perf counter pages)
 
 // --- Configuration ---
 const char *TARGET_DEVICE_NAME = "ILTP7807:00 222A:FFF1";
@@ -61,10 +66,174 @@ char* find_device_path_by_name(const char* targetName) { /* ... (same as before)
     if (event_num == -1) { fprintf(stderr, "[ERROR] Device with name \"%s\" not found or has no event handler.\n", targetName); } return NULL;
 }
 
+// --- Self-Profiling (--profile) ---
+// Same counters and report format as screenpad.c, so both builds can be compared on one recording (--replay). This build
+// decides gestures while handling ABS/KEY events, so its gesture logic shows up under decode; SYN_REPORT handling is gesture
+// and uinput writes are emit. Time spent reading input is not attributed.
+typedef enum { PROFILE_IDLE, PROFILE_DECODE, PROFILE_GESTURE, PROFILE_EMIT, PROFILE_PHASE_COUNT } ProfilePhase;
+const char *PROFILE_PHASE_NAMES[PROFILE_PHASE_COUNT] = { "idle", "decode", "gesture", "emit" };
+#define PROFILE_COUNTER_COUNT 6
+#define PROFILE_CALIBRATION_ROUNDS 8
+#define PROFILE_CALIBRATION_READS 16
+#define PROFILE_CTX_SWITCHES 4 // Software counters: no rdpmc, so the fast path reads them once per batch
+#define PROFILE_TASK_CLOCK 5
+typedef struct { const char *name; uint32_t type; uint64_t config; } ProfileCounter;
+const ProfileCounter PROFILE_COUNTERS[PROFILE_COUNTER_COUNT] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES }, { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }, { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "ctx-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }, { "task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+typedef struct {
+    int group_fd; int fds[PROFILE_COUNTER_COUNT]; int index[PROFILE_COUNTER_COUNT]; int nr; int user_only; // index: position in the group read, -1 if unavailable
+    int fast; struct perf_event_mmap_page *pages[PROFILE_COUNTER_COUNT]; // fast: hardware counters by rdpmc, task clock from the leader's time_running
+    ProfilePhase phase; uint64_t last[PROFILE_COUNTER_COUNT]; uint64_t time_enabled; uint64_t time_running;
+    unsigned long long totals[PROFILE_PHASE_COUNT][PROFILE_COUNTER_COUNT]; unsigned long long intervals[PROFILE_PHASE_COUNT];
+    unsigned long long busy[PROFILE_COUNTER_COUNT]; unsigned long long busy_intervals; // Whole batches (leaving idle to re-entering it)
+    double read_cost[PROFILE_COUNTER_COUNT]; // What one read adds to each counter; subtracted once per attributed interval
+    unsigned long long frames;
+} Profile;
+Profile profile = { .group_fd = -1 };
+volatile sig_atomic_t profile_dump_requested = 0;
+
+// One syscall for the whole group. In fast mode the task clock is taken from the leader's time_running, like the fast read.
+int profile_read_group(uint64_t *out) {
+    uint64_t buf[3 + PROFILE_COUNTER_COUNT]; int c; // { nr, time_enabled, time_running, values[nr] }
+    if (read(profile.group_fd, buf, sizeof(buf)) < (ssize_t)((3 + profile.nr) * sizeof(uint64_t))) { return -1; }
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { out[c] = profile.index[c] >= 0 ? buf[3 + profile.index[c]] : 0; }
+    profile.time_enabled = buf[1]; profile.time_running = buf[2]; if (profile.fast) { out[PROFILE_TASK_CLOCK] = buf[2]; } return 0;
+}
+#if defined(__x86_64__) || defined(__i386__)
+uint64_t profile_rdpmc(uint32_t counter) { uint32_t lo, hi; __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter)); return lo | ((uint64_t)hi << 32); }
+uint64_t profile_rdtsc() { uint32_t lo, hi; __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi)); return lo | ((uint64_t)hi << 32); }
+// Self-monitoring read of one counter through its mmap page (the seqlock protocol in linux/perf_event.h). Fails while the
+// counter is not on a PMC (multiplexed out), and then the caller falls back to the group read.
+int profile_read_page(const struct perf_event_mmap_page *pc, uint64_t *value, uint64_t *running) {
+    uint32_t seq, idx; uint64_t count, run;
+    do {
+        seq = __atomic_load_n(&pc->lock, __ATOMIC_ACQUIRE);
+        idx = pc->index; if (!pc->cap_user_rdpmc || idx == 0) { return -1; }
+        int64_t pmc = (int64_t)profile_rdpmc(idx - 1); pmc <<= 64 - pc->pmc_width; pmc >>= 64 - pc->pmc_width; count = pc->offset + (uint64_t)pmc; run = pc->time_running;
+        if (running != NULL) { uint64_t cyc = profile_rdtsc(); uint64_t quot = cyc >> pc->time_shift; uint64_t rem = cyc & (((uint64_t)1 << pc->time_shift) - 1); run += pc->time_offset + quot * pc->time_mult + ((rem * pc->time_mult) >> pc->time_shift); }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&pc->lock, __ATOMIC_ACQUIRE) != seq);
+    *value = count; if (running != NULL) { *running = run; } return 0;
+}
+int profile_read_fast(uint64_t *out) {
+    int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { out[c] = profile.last[c]; }
+    for (c = 0; c < PROFILE_CTX_SWITCHES; ++c) { if (profile.pages[c] != NULL && profile_read_page(profile.pages[c], &out[c], c == 0 ? &out[PROFILE_TASK_CLOCK] : NULL) == -1) { return -1; } }
+    return 0;
+}
+#else
+int profile_read_fast(uint64_t *out) { (void)out; return -1; }
+#endif
+// Adds the deltas since the last read to `phase` (idle is never reported); a context-switch delta goes to the busy total instead
+// when ctx_busy is set, since the fast path only learns it at the batch boundary.
+void profile_charge(ProfilePhase phase, const uint64_t *now, int ctx_busy) {
+    int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { uint64_t d = now[c] - profile.last[c]; if (c == PROFILE_CTX_SWITCHES && profile.fast) { if (ctx_busy) { profile.busy[c] += d; } } else { profile.totals[phase][c] += d; } profile.last[c] = now[c]; }
+    profile.intervals[phase]++;
+}
+// Charges everything counted since the last switch to the phase being left; returns that phase so callers can restore it.
+// With rdpmc every phase change is a few instructions in user space. Without it the counters are read only when a batch starts
+// and ends (next to the wait syscall anyway), so per-event syscalls don't pollute the caches and branch predictors being measured,
+// and only the batch total is known.
+ProfilePhase profile_switch(ProfilePhase phase) {
+    ProfilePhase prev = profile.phase; uint64_t now[PROFILE_COUNTER_COUNT]; int c;
+    if (profile.group_fd < 0 || phase == prev) { return prev; }
+    profile.phase = phase;
+    if (prev == PROFILE_IDLE) { // Batch starts: drop what the wait counted, then take the baseline in user space if we can
+        if (profile_read_group(now) == 0) { profile_charge(PROFILE_IDLE, now, 0); }
+        if (profile.fast && profile_read_fast(now) == 0) { profile_charge(PROFILE_IDLE, now, 0); }
+        return prev;
+    }
+    if (profile.fast) {
+        if (profile_read_fast(now) == 0 || profile_read_group(now) == 0) { profile_charge(prev, now, 1); }
+        if (phase == PROFILE_IDLE && profile_read_group(now) == 0) { profile_charge(PROFILE_IDLE, now, 1); profile.busy_intervals++; } // Batch ends: context switches
+        return prev;
+    }
+    if (phase == PROFILE_IDLE && profile_read_group(now) == 0) { for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { profile.busy[c] += now[c] - profile.last[c]; profile.last[c] = now[c]; } profile.busy_intervals++; }
+    return prev;
+}
+// Maps each hardware counter's page and keeps the fast path only if every one of them, and the leader's clock, can be read
+// from user space.
+void profile_setup_fast() {
+#if defined(__x86_64__) || defined(__i386__)
+    long page = sysconf(_SC_PAGESIZE); int c;
+    profile.fast = profile.index[0] == 0; // The leader must be cycles: its time_running is the task clock
+    for (c = 0; c < PROFILE_CTX_SWITCHES && profile.fast; ++c) {
+        if (profile.index[c] < 0) { continue; }
+        void *p = mmap(NULL, (size_t)page, PROT_READ, MAP_SHARED, profile.fds[c], 0); if (p == MAP_FAILED) { profile.fast = 0; break; }
+        profile.pages[c] = p; if (!profile.pages[c]->cap_user_rdpmc || (c == 0 && !profile.pages[c]->cap_user_time)) { profile.fast = 0; }
+    }
+    uint64_t probe[PROFILE_COUNTER_COUNT]; if (profile.fast && profile_read_fast(probe) == -1) { profile.fast = 0; }
+    if (!profile.fast) { long pg = page; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.pages[c] != NULL) { munmap(profile.pages[c], (size_t)pg); profile.pages[c] = NULL; } } }
+#endif
+}
+int profile_open() {
+    struct perf_event_attr attr; int c, user_only;
+    for (user_only = 0; user_only <= 1 && profile.group_fd < 0; ++user_only) { // Retry without kernel counting if perf_event_paranoid forbids it
+        profile.nr = 0;
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) {
+            memset(&attr, 0, sizeof(attr)); attr.size = sizeof(attr); attr.type = PROFILE_COUNTERS[c].type; attr.config = PROFILE_COUNTERS[c].config;
+            attr.disabled = (profile.group_fd < 0); attr.exclude_hv = 1; attr.exclude_kernel = user_only;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            profile.fds[c] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, profile.group_fd, PERF_FLAG_FD_CLOEXEC); profile.index[c] = -1;
+            if (profile.fds[c] == -1) { continue; }
+            if (profile.group_fd < 0) { profile.group_fd = profile.fds[c]; }
+            profile.index[c] = profile.nr++;
+        }
+        profile.user_only = user_only;
+    }
+    if (profile.group_fd < 0) { fprintf(stderr, "[ERROR] perf_event_open failed: %s (see /proc/sys/kernel/perf_event_paranoid).\n", strerror(errno)); return -1; }
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.index[c] < 0) { fprintf(stderr, "[WARN] Counter '%s' is not available on this machine.\n", PROFILE_COUNTERS[c].name); } }
+    if (ioctl(profile.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) { perror("[ERROR] Cannot enable perf counters"); return -1; }
+    profile_setup_fast();
+    // Calibrate the cost of a read so that phases entered many times per frame are not inflated by the measurement itself.
+    // The cheapest of several rounds is kept: a round that got preempted or faulted says nothing about the steady state.
+    uint64_t first[PROFILE_COUNTER_COUNT]; int round, r;
+    for (round = 0; round < PROFILE_CALIBRATION_ROUNDS; ++round) {
+        if (profile_read_group(first) == -1) { perror("[ERROR] Cannot read perf counters"); return -1; }
+        if (profile.fast) { profile_read_fast(first); }
+        for (r = 0; r < PROFILE_CALIBRATION_READS; ++r) { if (profile.fast) { profile_read_fast(profile.last); } else { profile_read_group(profile.last); } }
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double cost = (double)(profile.last[c] - first[c]) / PROFILE_CALIBRATION_READS; if (round == 0 || cost < profile.read_cost[c]) { profile.read_cost[c] = cost; } }
+    }
+    profile_read_group(profile.last); profile.phase = PROFILE_IDLE;
+    printf("[INFO] Profiling with perf counters (%s, %s).\n", profile.user_only ? "user space only" : "user + kernel", profile.fast ? "rdpmc: per-phase breakdown" : "no rdpmc: batch totals only");
+    return 0;
+}
+void profile_print_row(const char *label, const double *v) {
+    int c; printf("[PROFILE] %-8s", label);
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.index[c] < 0 || isnan(v[c])) { printf(" %14s", "n/a"); } else { printf(c == PROFILE_CTX_SWITCHES ? " %14.4f" : " %14.1f", v[c]); } }
+    if (profile.index[0] >= 0 && profile.index[1] >= 0 && v[0] > 0) { printf(" %6.2f", v[1] / v[0]); }
+    printf("\n");
+}
+void profile_print() {
+    double row[PROFILE_COUNTER_COUNT], total[PROFILE_COUNTER_COUNT] = {0}; unsigned long long reads = 0; int p, c;
+    if (profile.group_fd < 0) { return; }
+    ProfilePhase phase = profile_switch(PROFILE_IDLE); profile_switch(phase); // Bring the totals up to date
+    double frames = profile.frames ? (double)profile.frames : 1.0;
+    printf("[PROFILE] %llu input frames, %s, per frame:\n", profile.frames, profile.user_only ? "user space only" : "user + kernel");
+    printf("[PROFILE] %-8s", "phase"); for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { printf(" %14s", PROFILE_COUNTERS[c].name); } printf(" %6s\n", "IPC");
+    if (profile.fast) {
+        for (p = PROFILE_DECODE; p < PROFILE_PHASE_COUNT; ++p) {
+            for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double v = (double)profile.totals[p][c] - profile.intervals[p] * profile.read_cost[c]; row[c] = (v > 0 ? v : 0) / frames; total[c] += row[c]; }
+            row[PROFILE_CTX_SWITCHES] = NAN; profile_print_row(PROFILE_PHASE_NAMES[p], row); reads += profile.intervals[p];
+        }
+        total[PROFILE_CTX_SWITCHES] = profile.busy[PROFILE_CTX_SWITCHES] / frames; profile_print_row("total", total);
+        printf("[PROFILE] %.1f rdpmc reads per frame (~%.0f cycles each) are already subtracted; context switches are counted per batch.\n", reads / frames, profile.read_cost[0]);
+    } else {
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double v = (double)profile.busy[c] - profile.busy_intervals * profile.read_cost[c]; total[c] = (v > 0 ? v : 0) / frames; }
+        profile_print_row("total", total);
+        printf("[PROFILE] No user-space counter access (rdpmc), so only batch totals are measured; a per-phase split would need a syscall per event.\n");
+    }
+    if (profile.time_running < profile.time_enabled) { printf("[PROFILE] Counters were multiplexed (running %.0f%% of the time); values are not scaled.\n", 100.0 * profile.time_running / profile.time_enabled); }
+    fflush(stdout);
+}
+void profile_close() { int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.pages[c] != NULL) { munmap(profile.pages[c], (size_t)sysconf(_SC_PAGESIZE)); profile.pages[c] = NULL; } if (profile.index[c] >= 0) { close(profile.fds[c]); } } profile.group_fd = -1; profile.fast = 0; }
+
 // --- uinput Helper Functions ---
 int send_uinput_event(int fd, unsigned short type, unsigned short code, int value) { /* ... (same as before) ... */
     struct input_event ev; memset(&ev, 0, sizeof(ev)); ev.type = type; ev.code = code; ev.value = value;
-    ssize_t n = write(fd, &ev, sizeof(ev)); if (n != sizeof(ev)) { fprintf(stderr, "[ERROR] Failed to write event to uinput device (type:%u code:%u value:%d): %s\n", type, code, value, strerror(errno)); return -1; } return 0;
+    ProfilePhase phase = profile_switch(PROFILE_EMIT); ssize_t n = write(fd, &ev, sizeof(ev)); profile_switch(phase); if (n != sizeof(ev)) { fprintf(stderr, "[ERROR] Failed to write event to uinput device (type:%u code:%u value:%d): %s\n", type, code, value, strerror(errno)); return -1; } return 0;
 }
 int setup_uinput_device() { /* ... (same as before, V2.1) ... */
     int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK); if (fd == -1) { perror("[ERROR] Cannot open /dev/uinput"); fprintf(stderr, ">>> Ensure 'uinput' kernel module is loaded and you have write permissions.\n"); return -1; }
@@ -90,23 +259,41 @@ long timeval_diff_ms(struct timeval *start, struct timeval *end) {
 
 
 // --- Main Function ---
-int main() {
+// SIGINT/SIGTERM stop the loop so cleanup runs; SIGUSR1 prints the profile.
+volatile sig_atomic_t stop_requested = 0;
+void handle_signal(int sig) { if (sig == SIGUSR1) { profile_dump_requested = 1; } else { stop_requested = 1; } }
+int main(int argc, char *argv[]) {
     int evdev_fd = -1; int uinput_fd = -1; struct input_event ev; ssize_t n;
     int grab = 1; char *device_path = NULL; int needs_sync = 0;
+    const char *replay_path = NULL; int profiling = 0; int i;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--profile") == 0) { profiling = 1; }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) { replay_path = argv[++i]; } // A screenpad --record file
+        else { fprintf(stderr, "Usage: %s [--replay FILE] [--profile]\n", argv[0]); return EXIT_FAILURE; }
+    }
+    struct sigaction sa; memset(&sa, 0, sizeof(sa)); sa.sa_handler = handle_signal; sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL); sigaction(SIGTERM, &sa, NULL); if (profiling) { sigaction(SIGUSR1, &sa, NULL); }
 
     printf("Starting C Evdev Mapper (V2.2 - Drag Logic Fix)...\n"); // Version indication
     printf("!!! This program must be run with root privileges (sudo).\n");
     printf("!!! Input events will be GRABBED and not reach the OS.\n");
 
-    // 1. Find the evdev device path
-    device_path = find_device_path_by_name(TARGET_DEVICE_NAME);
-    if (device_path == NULL) { return EXIT_FAILURE; }
+    if (replay_path != NULL) { // The recording is read exactly like the device node
+        evdev_fd = open(replay_path, O_RDONLY);
+        if (evdev_fd == -1) { fprintf(stderr, "[ERROR] Cannot open recording \"%s\": %s\n", replay_path, strerror(errno)); return EXIT_FAILURE; }
+        printf("[INFO] Replaying events from %s\n", replay_path);
+    } else {
+        // 1. Find the evdev device path
+        device_path = find_device_path_by_name(TARGET_DEVICE_NAME);
+        if (device_path == NULL) { return EXIT_FAILURE; }
 
-    // 2. Open and Grab the evdev device
-    evdev_fd = open(device_path, O_RDONLY | O_NONBLOCK);
-    if (evdev_fd == -1) { fprintf(stderr, "[ERROR] Cannot open evdev device \"%s\": %s\n", device_path, strerror(errno)); goto cleanup; }
-    if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[ERROR] Cannot grab evdev device"); goto cleanup; }
-    printf("[INFO] Successfully grabbed evdev device: %s\n", device_path);
+        // 2. Open and Grab the evdev device
+        evdev_fd = open(device_path, O_RDONLY | O_NONBLOCK);
+        if (evdev_fd == -1) { fprintf(stderr, "[ERROR] Cannot open evdev device \"%s\": %s\n", device_path, strerror(errno)); goto cleanup; }
+        if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[ERROR] Cannot grab evdev device"); goto cleanup; }
+        printf("[INFO] Successfully grabbed evdev device: %s\n", device_path);
+    }
 
     // 3. Setup the virtual uinput device
     uinput_fd = setup_uinput_device();
@@ -115,15 +302,20 @@ int main() {
     sleep(1);
 
     printf("[INFO] Ready. Swipe=Move, Tap=Click, DoubleTap+Hold+Swipe=Drag. Ctrl+C=Exit.\n");
+    if (profiling && profile_open() == -1) { goto cleanup; }
 
     // 4. Main Event Loop
-    while (1) {
+    while (!stop_requested) {
+        if (profile_dump_requested) { profile_dump_requested = 0; profile_print(); }
+        profile_switch(PROFILE_IDLE);
         n = read(evdev_fd, &ev, sizeof(struct input_event));
 
         if (n == (ssize_t)-1) { if (errno == EINTR) continue; if (errno == EWOULDBLOCK) { if (needs_sync) { if(send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { needs_sync = 0; } } usleep(5000); continue; } else { perror("\n[ERROR] Error reading events from evdev device"); break; } }
+        else if (n == 0 && replay_path != NULL) { printf("[INFO] Replay finished.\n"); errno = 0; break; }
         else if (n == 0 || n != sizeof(struct input_event)) { fprintf(stderr, "\n[WARN] Read %ld bytes (expected %ld). Ignoring.\n", n, sizeof(struct input_event)); continue; }
 
         // --- Process the received event ---
+        profile_switch(ev.type == EV_SYN ? PROFILE_GESTURE : PROFILE_DECODE); if (ev.type == EV_SYN && ev.code == SYN_REPORT) { profile.frames++; }
         switch (ev.type) {
             case EV_ABS:
                 {
@@ -207,8 +399,7 @@ int main() {
 
             case EV_KEY:
                 if (ev.code == BTN_TOUCH) {
-                    struct timeval current_time;
-                    gettimeofday(&current_time, NULL);
+                    struct timeval current_time = ev.time; // Kernel timestamp (CLOCK_REALTIME, like gettimeofday); keeps replays faithful
 
                     if (ev.value == 1) { // Just touched down
                         if (!touch_state.touching) {
@@ -282,8 +473,10 @@ cleanup:
          send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0);
          send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0);
     }
+    if (profiling) { profile_print(); profile_close(); }
     destroy_uinput_device(uinput_fd);
-    if (evdev_fd >= 0) { /* ... (Ungrab and close evdev) ... */
+    if (evdev_fd >= 0 && replay_path != NULL) { close(evdev_fd); }
+    else if (evdev_fd >= 0) { /* ... (Ungrab and close evdev) ... */
         grab = 0; if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[WARN] Failed to ungrab evdev device"); } else { printf("[INFO] Evdev device ungrabbed.\n"); }
         if (close(evdev_fd) == -1) { perror("[WARN] Failed to close evdev device file descriptor"); }
     }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // ppoll
 #include <stdio.h>      // printf, fprintf, perror, FILE, fopen, fgets, fclose, fflush
 #include <stdlib.h>     // exit, EXIT_FAILURE, EXIT_SUCCESS, malloc, free, abs
 #include <string.h>     // strerror, strncmp, strstr, strlen, strcmp, memset
@@ -10,207 +11,1484 @@
 #include <linux/input-event-codes.h> // EV_*, KEY_*, ABS_*, SYN_*, REL_*, BTN_*, ABS_MT_*
 #include <linux/uinput.h> // uinput specific definitions
 #include <sys/ioctl.h>  // ioctl
+#include <sys/mman.h>   // shm_open, shm_unlink, mmap, munmap
+#include <sys/stat.h>   // fchmod, S_IRUSR, S_IWUSR, S_IRGRP, S_IROTH
+#include <stdint.h>     // int32_t, int64_t, uint32_t, uint64_t
+#include <limits.h>     // LLONG_MAX
+#include <poll.h>       // poll, struct pollfd
+#include <time.h>       // clock_gettime, clock_nanosleep
+#include <sched.h>      // sched_yield
+#include <signal.h>     // kill, sigaction, SIGTERM, SIGINT, SIGUSR1
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter, __NR_perf_event_open
+#include <sys/resource.h> // getrusage
+#include <sys/wait.h>   // waitpid
+#include <linux/io_uring.h> // struct io_uring_params, io_uring_sqe, io_uring_cqe, IORING_*
+#include <linux/perf_event.h> // struct perf_event_attr, PERF_COUNT_*, PERF_EVENT_IOC_*
+#include <sys/inotify.h> // inotify_init1, inotify_add_watch, struct inotify_event
+#include <pthread.h>    // pthread_create, pthread_join, pthread_sigmask
+#include <sys/eventfd.h> // eventfd
+#include <stddef.h>     // offsetof
+#include <ctype.h>      // isspace
 
 // --- Configuration ---
 const char *TARGET_DEVICE_NAME = "ILTP7807:00 222A:FFF1";
 #define MAX_SLOTS 10 // Max number of touch slots to track
+#define EVENT_BATCH_MAX 512 // Max evdev events taken per read (enough to drain the kernel queue after a stall)
+#define OUT_FRAME_MAX 64 // Max uinput events buffered per output frame
 
-// Single-finger settings
-const double SENSITIVITY = 1.2;
-const int DEAD_ZONE_THRESHOLD_SQ_MOVE = 10 * 10; // Dead zone for STARTING cursor movement
-const int DEAD_ZONE_THRESHOLD_SQ_DRAG_START = 30 * 30; // Larger dead zone for STARTING a drag
-const int DEAD_ZONE_THRESHOLD_SQ_TAP_ONE = 20 * 20; // Dead zone for qualifying a single-finger TAP
-const long TAP_TIMEOUT_MS_SINGLE = 180;          // Timeout for single-finger tap (LClick)
-const long DOUBLE_TAP_TIMEOUT_MS = 150;         // Max interval between taps for double-tap/drag
+// Gesture tunables. The hot path reads them through `settings`, so a config file (--config) or the offline tuner (--tune) can swap in alternatives.
+typedef struct {
+    // Single-finger settings
+    double sensitivity;
+    int dead_zone_threshold_sq_move; int dead_zone_threshold_sq_drag_start; int dead_zone_threshold_sq_tap_one;
+    long tap_timeout_ms_single; long double_tap_timeout_ms;
+    // Two-finger settings
+    int dead_zone_threshold_sq_tap_two; long tap_timeout_ms_two;
+    int dead_zone_threshold_sq_pinch; double pinch_wheel_per_doubling;
+    // Deadline-driven gestures (0 disables)
+    long long_press_ms; long drag_lock_ms; int defer_tap_click;
+    // Adaptive jitter filter on slot positions (One-Euro; min cutoff 0 disables)
+    double filter_min_cutoff_hz; double filter_beta; double filter_d_cutoff_hz;
+    // Palm/ghost rejection at decode time (0 disables a rule)
+    double palm_major_mm; double palm_edge_mm; double ghost_pressure_pct;
+} Settings;
+const Settings DEFAULT_SETTINGS = {
+    .sensitivity = 1.2,
+    .dead_zone_threshold_sq_move = 6 * 6,         // Dead zone for STARTING cursor movement (the jitter filter absorbs resting noise)
+    .dead_zone_threshold_sq_drag_start = 30 * 30, // Larger dead zone for STARTING a drag
+    .dead_zone_threshold_sq_tap_one = 20 * 20,    // Dead zone for qualifying a single-finger TAP
+    .tap_timeout_ms_single = 180,                 // Timeout for single-finger tap (LClick)
+    .double_tap_timeout_ms = 150,                 // Max interval between taps for double-tap/drag
+    .dead_zone_threshold_sq_tap_two = 20 * 20,    // Movement threshold for 2-finger tap (RClick)
+    .tap_timeout_ms_two = 200,                    // Timeout for 2-finger tap (RClick)
+    .dead_zone_threshold_sq_pinch = 40 * 40,      // Change in finger distance needed to START a pinch zoom (also must beat the pan of the pair)
+    .pinch_wheel_per_doubling = 480,              // REL_WHEEL_HI_RES units (120 = one notch) sent with Ctrl per doubling of finger distance
+    .long_press_ms = 700,                         // Holding one finger still this long sends a Right Click
+    .drag_lock_ms = 0,                            // Keep the button held this long after a drag finger lifts, to continue the drag
+    .defer_tap_click = 0,                         // 1: hold a tap's click until the double-tap window closes, so tap-and-drag sends no stray click
+    .filter_min_cutoff_hz = 1.5,                  // Jitter filter cutoff for a still finger: lower = steadier cursor at rest
+    .filter_beta = 0.02,                          // Cutoff added per unit/s of finger speed: higher = less lag on fast swipes
+    .filter_d_cutoff_hz = 1.0,                    // Smoothing of the finger speed estimate that drives the cutoff
+    .palm_major_mm = 14.0,                        // Contacts at least this long (ABS_MT_TOUCH_MAJOR) are palms; half of it is enough inside the edge band
+    .palm_edge_mm = 4.0,                          // Width of the edge band where resting thumbs and hand edges land
+    .ghost_pressure_pct = 3.0,                    // Touch-downs below this share of the ABS_MT_PRESSURE range are ghosts
+};
+const Settings *settings = &DEFAULT_SETTINGS;
 
-// Two-finger settings
-const int DEAD_ZONE_THRESHOLD_SQ_TAP_TWO = 20 * 20; // Movement threshold for 2-finger tap (RClick)
-const long TAP_TIMEOUT_MS_TWO = 200;              // Timeout for 2-finger tap (RClick)
+// Output mode (--mode=): our own gesture engine on a relative mouse or on an absolute tablet, or a rotated MT touchpad left to libinput
+typedef enum { OUTPUT_MODE_GESTURES, OUTPUT_MODE_PASSTHROUGH, OUTPUT_MODE_ABSOLUTE } OutputMode;
+OutputMode output_mode = OUTPUT_MODE_GESTURES;
 
 // --- State Structures ---
-typedef struct { int active; int tracking_id; int x; int y; int start_x; int start_y; int last_x; int last_y; } SlotState;
+typedef struct {
+    int active; int tracking_id; int x; int y; int start_x; int start_y; int last_x; int last_y; // x/y: filtered position the gestures work on
+    int raw_x; int raw_y; double filt_x; double filt_y; double filt_speed; long long filt_t_us; // Jitter filter input and state (filt_t_us 0: unprimed)
+} SlotState;
 typedef struct {
     SlotState slots[MAX_SLOTS]; int current_slot; int active_finger_count;
     int is_moving; int potential_single_tap; int potential_drag_start; int drag_active;
     struct timeval touch_down_time_single; struct timeval last_touch_up_time;
     int potential_two_finger_tap; struct timeval two_finger_touch_time; int two_finger_start_coords_set;
+    int last_dx_rel; int last_dy_rel; // REL deltas emitted during the most recent frame (0 if none)
+    int double_tap_window_open; int pending_tap_click; int long_press_fired; int drag_locked; int drag_resumed;
+    int pinch_tracking; int pinch_active; double pinch_start_dist; double pinch_start_cx; double pinch_start_cy; int pinch_hires_sent; int pinch_notches_sent;
+    int long_press_clicks; // Right Clicks sent by long press, so --tune can tell them from two-finger taps
 } GestureState;
 GestureState gesture_state = {0};
+clockid_t engine_clock = CLOCK_MONOTONIC; // Clock of the evdev timestamps (set with EVIOCSCLOCKID) and of gesture deadlines
+struct input_absinfo src_abs_x, src_abs_y; // EVIOCGABS ranges of ABS_MT_POSITION_X/Y on the grabbed device
+struct input_absinfo src_abs_major, src_abs_pressure, src_abs_tool; // ABS_MT_TOUCH_MAJOR, ABS_MT_PRESSURE, ABS_MT_TOOL_TYPE; zeroed when the device lacks the axis
+typedef enum { CONTACT_FINGER, CONTACT_PALM, CONTACT_GHOST, CONTACT_EDGE, CONTACT_CLASS_COUNT } ContactClass; // Decode-time verdict on a contact (see Palm & Ghost Rejection)
+unsigned long long contacts_rejected[CONTACT_CLASS_COUNT]; unsigned long long contacts_rejected_late = 0; unsigned long long palm_dropped_events = 0;
+
+// --- Shared-Memory State Export ---
+// A seqlock-protected copy of GestureState, republished once per SYN_REPORT.
+// Readers map SHM_STATE_NAME read-only and retry while `seq` is odd or changes under them,
+// so they never block the event loop and the loop never waits for them.
+#define SHM_STATE_NAME "/screenpad-state"
+#define SHM_STATE_MAGIC 0x44415053u // "SPAD"
+#define SHM_STATE_VERSION 2
+typedef struct { int32_t active; int32_t tracking_id; int32_t x; int32_t y; int32_t start_x; int32_t start_y; } ShmSlotState;
+typedef struct {
+    uint32_t magic; uint32_t version; uint32_t seq; uint32_t max_slots;
+    uint64_t frame_count; int64_t frame_time_us; // Kernel timestamp of the SYN_REPORT that produced this snapshot
+    int32_t active_finger_count; int32_t current_slot;
+    int32_t is_moving; int32_t potential_single_tap; int32_t potential_drag_start; int32_t drag_active; int32_t potential_two_finger_tap;
+    int32_t last_dx_rel; int32_t last_dy_rel;
+    uint32_t rejected_palm; uint32_t rejected_ghost; uint32_t rejected_edge; // Contacts dropped by palm/ghost rejection so far
+    ShmSlotState slots[MAX_SLOTS];
+} ShmStateSnapshot;
+ShmStateSnapshot *shm_state = NULL;
 
 // --- Helper Functions ---
 const char* get_event_type_str(unsigned short type){ switch(type){ case EV_SYN: return "EV_SYN"; case EV_KEY: return "EV_KEY"; case EV_REL: return "EV_REL"; case EV_ABS: return "EV_ABS"; case EV_MSC: return "EV_MSC"; case EV_SW: return "EV_SW"; case EV_LED: return "EV_LED"; case EV_SND: return "EV_SND"; case EV_REP: return "EV_REP"; default: return "Unknown Type"; } }
 const char* get_code_str(unsigned short type, unsigned short code){ switch(type){ case EV_SYN: switch(code){ case SYN_REPORT: return "SYN_REPORT"; case SYN_CONFIG: return "SYN_CONFIG"; case SYN_MT_REPORT: return "SYN_MT_REPORT"; case SYN_DROPPED: return "SYN_DROPPED"; default: return "SYN_UNKNOWN"; } case EV_KEY: if(code==BTN_TOUCH) return "BTN_TOUCH"; if(code==BTN_LEFT) return "BTN_LEFT"; if(code==BTN_RIGHT) return "BTN_RIGHT"; return "KEY_Code"; case EV_REL: switch(code){ case REL_X: return "REL_X"; case REL_Y: return "REL_Y"; case REL_WHEEL: return "REL_WHEEL"; case REL_HWHEEL: return "REL_HWHEEL"; default: return "REL_UNKNOWN"; } case EV_ABS: switch(code){ case ABS_X: return "ABS_X"; case ABS_Y: return "ABS_Y"; case ABS_MT_SLOT: return "ABS_MT_SLOT"; case ABS_MT_TRACKING_ID: return "ABS_MT_TRACKING_ID"; case ABS_MT_POSITION_X: return "ABS_MT_POSITION_X"; case ABS_MT_POSITION_Y: return "ABS_MT_POSITION_Y"; case ABS_MT_PRESSURE: return "ABS_MT_PRESSURE"; default: return "ABS_UNKNOWN"; } case EV_MSC: switch(code){ case MSC_SCAN: return "MSC_SCAN"; case MSC_SERIAL: return "MSC_SERIAL"; default: return "MSC_UNKNOWN"; } default: return "CODE_UNKNOWN"; } }
 char* find_device_path_by_name(const char* targetName){ FILE *fp; char line[256]; char current_name[256] = {0}; char handlers_line[256] = {0}; int found_name_block = 0; char *event_ptr; int event_num = -1; char *device_path = NULL; fp = fopen("/proc/bus/input/devices", "r"); if (fp == NULL) { perror("[ERROR] Cannot open /proc/bus/input/devices"); return NULL; } while (fgets(line, sizeof(line), fp) != NULL) { if (strncmp(line, "N: Name=", 8) == 0) { found_name_block = 0; if (sscanf(line + 8, " \"%[^\"]\"", current_name) == 1 || sscanf(line + 8, "%[^\n]", current_name) == 1) { if (strcmp(current_name, targetName) == 0) { found_name_block = 1; } } } else if (found_name_block && strncmp(line, "H: Handlers=", 12) == 0) { strncpy(handlers_line, line + 12, sizeof(handlers_line) - 1); handlers_line[sizeof(handlers_line) - 1] = '\0'; event_ptr = strstr(handlers_line, "event"); if (event_ptr != NULL) { if (sscanf(event_ptr, "event%d", &event_num) == 1) { break; } } found_name_block = 0; } else if (line[0] == '\n') { found_name_block = 0; } } fclose(fp); if (event_num != -1) { device_path = (char*)malloc(strlen("/dev/input/event") + 10 + 1); if (device_path != NULL) { sprintf(device_path, "/dev/input/event%d", event_num); if (access(device_path, F_OK) == 0) { printf("[INFO] Found device \"%s\" corresponds to path: %s\n", targetName, device_path); return device_path; } else { fprintf(stderr, "[WARN] Found handler 'event%d' for \"%s\", but path %s does not exist or is not accessible.\n", event_num, targetName, device_path); free(device_path); device_path = NULL; } } else { perror("[ERROR] Failed to allocate memory for device path"); } } if (event_num == -1) { fprintf(stderr, "[ERROR] Device with name \"%s\" not found or has no event handler.\n", targetName); } return NULL; }
+long long timeval_us(const struct timeval *tv) { return (long long)tv->tv_sec * 1000000LL + tv->tv_usec; }
+long long engine_clock_now_us() { struct timespec ts; clock_gettime(engine_clock, &ts); return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000; }
+long long monotonic_ns() { struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts); return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec; }
 long timeval_diff_ms(struct timeval *start, struct timeval *end){ return (long)(end->tv_sec - start->tv_sec) * 1000 + (long)(end->tv_usec - start->tv_usec) / 1000;}
 // --- uinput Helper Functions ---
-int send_uinput_event(int fd, unsigned short type, unsigned short code, int value) { struct input_event ev; memset(&ev, 0, sizeof(ev)); ev.type = type; ev.code = code; ev.value = value; /*printf("      [DEBUG] Sending uinput: type=%u (%s), code=%u (%s), value=%d\n", type, get_event_type_str(type), code, get_code_str(type, code), value);*/ ssize_t n = write(fd, &ev, sizeof(ev)); if (n != sizeof(ev)) { fprintf(stderr, "[ERROR] Failed to write event to uinput device (type:%u code:%u value:%d): %s\n", type, code, value, strerror(errno)); return -1; } return 0; }
-int setup_uinput_device() { int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK); if (fd == -1) { perror("[ERROR] Cannot open /dev/uinput"); fprintf(stderr, ">>> Ensure 'uinput' kernel module is loaded and you have write permissions.\n"); return -1; } if (ioctl(fd, UI_SET_EVBIT, EV_REL) == -1) goto error; if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1) goto error; if (ioctl(fd, UI_SET_EVBIT, EV_SYN) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_X) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_Y) == -1) goto error; if (ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) == -1) goto error; if (ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT) == -1) goto error; struct uinput_user_dev uidev; memset(&uidev, 0, sizeof(uidev)); snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "Screenpad Unified Handler"); uidev.id.bustype = BUS_VIRTUAL; uidev.id.vendor  = 0xABCD; uidev.id.product = 0xABCD; uidev.id.version = 1; if (write(fd, &uidev, sizeof(uidev)) != sizeof(uidev)) goto error; if (ioctl(fd, UI_DEV_CREATE) == -1) goto error; printf("[INFO] Created virtual uinput device: %s\n", uidev.name); return fd; error: perror("[ERROR] Failed to setup uinput device via ioctl"); close(fd); return -1; }
+// Output is buffered per frame: events are queued and the whole frame is handed to the I/O backend at EV_SYN.
+struct input_event out_frame[OUT_FRAME_MAX]; int out_frame_len = 0;
+int flush_uinput_frame(int fd); // Defined with the I/O backends below
+int send_uinput_event(int fd, unsigned short type, unsigned short code, int value) { struct input_event *ev = &out_frame[out_frame_len++]; memset(ev, 0, sizeof(*ev)); ev->type = type; ev->code = code; ev->value = value; /*printf("      [DEBUG] Sending uinput: type=%u (%s), code=%u (%s), value=%d\n", type, get_event_type_str(type), code, get_code_str(type, code), value);*/ if (type == EV_SYN || out_frame_len == OUT_FRAME_MAX) { return flush_uinput_frame(fd); } return 0; }
+int setup_uinput_touchpad(); int setup_uinput_tablet();
+int setup_uinput_device() { if (output_mode == OUTPUT_MODE_PASSTHROUGH) { return setup_uinput_touchpad(); } if (output_mode == OUTPUT_MODE_ABSOLUTE) { return setup_uinput_tablet(); } int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK); if (fd == -1) { perror("[ERROR] Cannot open /dev/uinput"); fprintf(stderr, ">>> Ensure 'uinput' kernel module is loaded and you have write permissions.\n"); return -1; } if (ioctl(fd, UI_SET_EVBIT, EV_REL) == -1) goto error; if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1) goto error; if (ioctl(fd, UI_SET_EVBIT, EV_SYN) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_X) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_Y) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_WHEEL) == -1) goto error; if (ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES) == -1) goto error; if (ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) == -1) goto error; if (ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT) == -1) goto error; if (ioctl(fd, UI_SET_KEYBIT, KEY_LEFTCTRL) == -1) goto error; struct uinput_user_dev uidev; memset(&uidev, 0, sizeof(uidev)); snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "Screenpad Unified Handler"); uidev.id.bustype = BUS_VIRTUAL; uidev.id.vendor  = 0xABCD; uidev.id.product = 0xABCD; uidev.id.version = 1; if (write(fd, &uidev, sizeof(uidev)) != sizeof(uidev)) goto error; if (ioctl(fd, UI_DEV_CREATE) == -1) goto error; printf("[INFO] Created virtual uinput device: %s\n", uidev.name); return fd; error: perror("[ERROR] Failed to setup uinput device via ioctl"); close(fd); return -1; }
 void destroy_uinput_device(int fd) { if (fd >= 0) { printf("[INFO] Destroying virtual uinput device...\n"); if (ioctl(fd, UI_DEV_DESTROY) == -1) { fprintf(stderr, "[WARN] Failed to destroy uinput device: %s\n", strerror(errno)); } if (close(fd) == -1) { perror("[WARN] Failed to close uinput device file descriptor"); } } }
+// --- Shared-Memory Export Helper Functions ---
+// Always a fresh object: a leftover (or planted) one may still be mapped writable by whoever created it, so it is unlinked and
+// the new one is created with O_EXCL; losing that race disables the export rather than publishing into someone else's object.
+ShmStateSnapshot* shm_state_create() { shm_unlink(SHM_STATE_NAME); int fd = shm_open(SHM_STATE_NAME, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); if (fd == -1) { fprintf(stderr, "[WARN] Cannot create shared-memory state export %s: %s\n", SHM_STATE_NAME, strerror(errno)); return NULL; } if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 || ftruncate(fd, sizeof(ShmStateSnapshot)) == -1) { fprintf(stderr, "[WARN] Cannot size shared-memory state export: %s\n", strerror(errno)); close(fd); shm_unlink(SHM_STATE_NAME); return NULL; } ShmStateSnapshot *shm = mmap(NULL, sizeof(ShmStateSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); close(fd); if (shm == MAP_FAILED) { fprintf(stderr, "[WARN] Cannot map shared-memory state export: %s\n", strerror(errno)); shm_unlink(SHM_STATE_NAME); return NULL; } memset(shm, 0, sizeof(ShmStateSnapshot)); shm->version = SHM_STATE_VERSION; shm->max_slots = MAX_SLOTS; __atomic_store_n(&shm->magic, SHM_STATE_MAGIC, __ATOMIC_RELEASE); printf("[INFO] Publishing gesture state to shared memory: /dev/shm%s\n", SHM_STATE_NAME); return shm; }
+void shm_state_destroy(ShmStateSnapshot *shm) { if (shm == NULL) { return; } munmap(shm, sizeof(ShmStateSnapshot)); shm_unlink(SHM_STATE_NAME); }
+// Writer side of the seqlock: bump to odd, store the fields, bump back to even. Plain stores only, no syscalls.
+void shm_state_publish(ShmStateSnapshot *shm, const GestureState *gs, const struct timeval *frame_time) {
+    int i;
+    if (shm == NULL) { return; }
+    uint32_t seq = shm->seq;
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm->frame_count++; shm->frame_time_us = (int64_t)frame_time->tv_sec * 1000000 + frame_time->tv_usec;
+    shm->active_finger_count = gs->active_finger_count; shm->current_slot = gs->current_slot;
+    shm->is_moving = gs->is_moving; shm->potential_single_tap = gs->potential_single_tap; shm->potential_drag_start = gs->potential_drag_start; shm->drag_active = gs->drag_active; shm->potential_two_finger_tap = gs->potential_two_finger_tap;
+    shm->last_dx_rel = gs->last_dx_rel; shm->last_dy_rel = gs->last_dy_rel;
+    shm->rejected_palm = (uint32_t)contacts_rejected[CONTACT_PALM]; shm->rejected_ghost = (uint32_t)contacts_rejected[CONTACT_GHOST]; shm->rejected_edge = (uint32_t)contacts_rejected[CONTACT_EDGE];
+    for (i = 0; i < MAX_SLOTS; ++i) { shm->slots[i].active = gs->slots[i].active; shm->slots[i].tracking_id = gs->slots[i].tracking_id; shm->slots[i].x = gs->slots[i].x; shm->slots[i].y = gs->slots[i].y; shm->slots[i].start_x = gs->slots[i].start_x; shm->slots[i].start_y = gs->slots[i].start_y; }
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+// Reader side of the seqlock: copy until an even, unchanged sequence number brackets the copy.
+void shm_state_read(const ShmStateSnapshot *shm, ShmStateSnapshot *out) {
+    uint32_t seq_before, seq_after;
+    do {
+        seq_before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        memcpy(out, (const void *)shm, sizeof(ShmStateSnapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((seq_before & 1) || seq_before != seq_after);
+}
+// Maps the export read-only and keeps the descriptor, so the reader can later tell (st_nlink == 0) that the object was unlinked.
+// Returns 0 when mapped, -1 when the object is missing or not stamped yet (errors printed unless `quiet`), -2 on a version mismatch.
+int shm_state_open(const ShmStateSnapshot **out, int *out_fd, int quiet) {
+    int fd = shm_open(SHM_STATE_NAME, O_RDONLY, 0), ret = -1; if (fd == -1) { if (!quiet) { fprintf(stderr, "[ERROR] Cannot open %s (is screenpad running?): %s\n", SHM_STATE_NAME, strerror(errno)); } return -1; }
+    const ShmStateSnapshot *shm = mmap(NULL, sizeof(ShmStateSnapshot), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) { if (!quiet) { perror("[ERROR] Cannot map shared-memory state"); } close(fd); return -1; }
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHM_STATE_MAGIC) { if (!quiet) { fprintf(stderr, "[ERROR] %s has an unexpected layout (magic mismatch).\n", SHM_STATE_NAME); } goto error; } // A new object reads as zeroes until the writer stamps it
+    if (shm->version != SHM_STATE_VERSION) { fprintf(stderr, "[ERROR] %s has an unexpected layout (version %u, expected %d).\n", SHM_STATE_NAME, shm->version, SHM_STATE_VERSION); ret = -2; goto error; }
+    *out = shm; *out_fd = fd; return 0;
+error:
+    munmap((void *)shm, sizeof(ShmStateSnapshot)); close(fd); return ret;
+}
+// `screenpad --watch-state`: unprivileged reader that prints every new snapshot (sampled at ~100 Hz).
+// A restarted daemon unlinks the old object and creates a new one, so once frames stop advancing for a second the reader
+// checks whether its object was unlinked and, if so, maps the new one as soon as it appears.
+int watch_shm_state() {
+    const ShmStateSnapshot *shm = NULL; int fd = -1, ret; if (shm_state_open(&shm, &fd, 0) != 0) { return EXIT_FAILURE; }
+    ShmStateSnapshot snap; uint64_t last_frame = 0; int idle_polls = 0, i; struct stat st;
+    while (1) {
+        shm_state_read(shm, &snap);
+        if (snap.frame_count != last_frame) {
+            last_frame = snap.frame_count; idle_polls = 0;
+            printf("[STATE] frame=%llu t=%lld.%06lld fingers=%d moving=%d tap=%d drag_start=%d drag=%d tap2=%d d=(%d,%d) rejected=%u/%u/%u", (unsigned long long)snap.frame_count, (long long)(snap.frame_time_us / 1000000), (long long)(snap.frame_time_us % 1000000), snap.active_finger_count, snap.is_moving, snap.potential_single_tap, snap.potential_drag_start, snap.drag_active, snap.potential_two_finger_tap, snap.last_dx_rel, snap.last_dy_rel, snap.rejected_palm, snap.rejected_ghost, snap.rejected_edge);
+            for (i = 0; i < MAX_SLOTS; ++i) { if (snap.slots[i].active) { printf(" [%d]=(%d,%d)", i, snap.slots[i].x, snap.slots[i].y); } }
+            printf("\n"); fflush(stdout);
+        }
+        else if (++idle_polls >= 100 && fstat(fd, &st) == 0 && st.st_nlink == 0) {
+            printf("[INFO] %s was removed (screenpad stopped or restarted); waiting for a new one...\n", SHM_STATE_NAME); fflush(stdout);
+            munmap((void *)shm, sizeof(ShmStateSnapshot)); close(fd);
+            while ((ret = shm_state_open(&shm, &fd, 1)) != 0) { if (ret == -2) { return EXIT_FAILURE; } usleep(500000); }
+            printf("[INFO] Re-attached to %s\n", SHM_STATE_NAME); fflush(stdout); last_frame = 0; idle_polls = 0;
+        }
+        else if (idle_polls >= 100) { idle_polls = 0; } // Still linked: the daemon is just idle
+        usleep(10000);
+    }
+    return EXIT_SUCCESS;
+}
 
 
-// --- Main Function ---
-int main() {
-    int evdev_fd = -1; int uinput_fd = -1; struct input_event ev; ssize_t n;
-    int grab = 1; char *device_path = NULL; int needs_sync = 0;
+// --- Multitouch Passthrough ---
+// In OUTPUT_MODE_PASSTHROUGH the virtual device is a touchpad (ABS_MT_*, BTN_TOOL_*, INPUT_PROP_POINTER) and every MT frame is
+// forwarded as one batch with only the rotation and sensitivity scaling of the relative path applied: out_x follows +y, out_y follows -x.
+// Taps, scrolling, gestures and palm handling are then left to libinput in the compositor, so the contact size, pressure and
+// tool type axes the touchscreen has are forwarded too (touch major is in surface units and scales like the positions).
+int passthrough_out_x(int src_y) { return (int)round((double)(src_y - src_abs_y.minimum) * settings->sensitivity); }
+int passthrough_out_y(int src_x) { return (int)round((double)(src_abs_x.maximum - src_x) * settings->sensitivity); }
+int passthrough_out_major(int src_major) { return (int)round((double)src_major * settings->sensitivity); }
+int source_has_axis(const struct input_absinfo *abs) { return abs->maximum > abs->minimum; }
+int setup_uinput_abs_axis(int fd, unsigned short code, int minimum, int maximum, int resolution) { struct uinput_abs_setup abs; memset(&abs, 0, sizeof(abs)); abs.code = code; abs.absinfo.minimum = minimum; abs.absinfo.maximum = maximum; abs.absinfo.resolution = resolution; if (ioctl(fd, UI_SET_ABSBIT, code) == -1) { return -1; } return ioctl(fd, UI_ABS_SETUP, &abs); }
+int setup_uinput_touchpad() {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK); if (fd == -1) { perror("[ERROR] Cannot open /dev/uinput"); fprintf(stderr, ">>> Ensure 'uinput' kernel module is loaded and you have write permissions.\n"); return -1; }
+    int max_x = passthrough_out_x(src_abs_y.maximum); int max_y = passthrough_out_y(src_abs_x.minimum);
+    const unsigned short keys[] = { BTN_LEFT, BTN_TOUCH, BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP, BTN_TOOL_QUADTAP, BTN_TOOL_QUINTTAP }; size_t i;
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1 || ioctl(fd, UI_SET_EVBIT, EV_ABS) == -1 || ioctl(fd, UI_SET_EVBIT, EV_MSC) == -1 || ioctl(fd, UI_SET_EVBIT, EV_SYN) == -1) goto error;
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) { if (ioctl(fd, UI_SET_KEYBIT, keys[i]) == -1) goto error; }
+    if (ioctl(fd, UI_SET_MSCBIT, MSC_TIMESTAMP) == -1 || ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_POINTER) == -1) goto error;
+    // Axes swap under the rotation, so the output X resolution is the source Y resolution and vice versa
+    if (setup_uinput_abs_axis(fd, ABS_X, 0, max_x, src_abs_y.resolution) == -1 || setup_uinput_abs_axis(fd, ABS_Y, 0, max_y, src_abs_x.resolution) == -1) goto error;
+    if (setup_uinput_abs_axis(fd, ABS_MT_SLOT, 0, MAX_SLOTS - 1, 0) == -1 || setup_uinput_abs_axis(fd, ABS_MT_TRACKING_ID, 0, 65535, 0) == -1) goto error;
+    if (setup_uinput_abs_axis(fd, ABS_MT_POSITION_X, 0, max_x, src_abs_y.resolution) == -1 || setup_uinput_abs_axis(fd, ABS_MT_POSITION_Y, 0, max_y, src_abs_x.resolution) == -1) goto error;
+    if (source_has_axis(&src_abs_major) && setup_uinput_abs_axis(fd, ABS_MT_TOUCH_MAJOR, passthrough_out_major(src_abs_major.minimum), passthrough_out_major(src_abs_major.maximum), src_abs_major.resolution) == -1) goto error;
+    if (source_has_axis(&src_abs_pressure) && setup_uinput_abs_axis(fd, ABS_MT_PRESSURE, src_abs_pressure.minimum, src_abs_pressure.maximum, src_abs_pressure.resolution) == -1) goto error;
+    if (source_has_axis(&src_abs_tool) && setup_uinput_abs_axis(fd, ABS_MT_TOOL_TYPE, src_abs_tool.minimum, src_abs_tool.maximum, 0) == -1) goto error; // MT_TOOL_PALM reaches libinput's palm detection
+    struct uinput_setup usetup; memset(&usetup, 0, sizeof(usetup)); snprintf(usetup.name, UINPUT_MAX_NAME_SIZE, "Screenpad Virtual Touchpad"); usetup.id.bustype = BUS_VIRTUAL; usetup.id.vendor = 0xABCD; usetup.id.product = 0xABCE; usetup.id.version = 1;
+    if (ioctl(fd, UI_DEV_SETUP, &usetup) == -1 || ioctl(fd, UI_DEV_CREATE) == -1) goto error;
+    printf("[INFO] Created virtual uinput touchpad: %s (%dx%d units)\n", usetup.name, max_x + 1, max_y + 1);
+    return fd;
+error:
+    perror("[ERROR] Failed to setup uinput touchpad via ioctl"); close(fd); return -1;
+}
+int btn_tool_for_count(int count) { switch (count) { case 0: return -1; case 1: return BTN_TOOL_FINGER; case 2: return BTN_TOOL_DOUBLETAP; case 3: return BTN_TOOL_TRIPLETAP; case 4: return BTN_TOOL_QUADTAP; default: return BTN_TOOL_QUINTTAP; } }
+// Copy-and-transform of one evdev event into the current output frame. Only slot bookkeeping is kept (for BTN_TOOL_* and the shm export).
+void passthrough_event(int uinput_fd, const struct input_event *ev, int *reported_count) {
+    GestureState *gs = &gesture_state; SlotState *slot = (gs->current_slot >= 0 && gs->current_slot < MAX_SLOTS) ? &gs->slots[gs->current_slot] : NULL;
+    switch (ev->type) {
+        case EV_ABS:
+            switch (ev->code) {
+                case ABS_MT_SLOT: if (ev->value >= 0 && ev->value < MAX_SLOTS) { gs->current_slot = ev->value; send_uinput_event(uinput_fd, EV_ABS, ABS_MT_SLOT, ev->value); } else { gs->current_slot = -1; } break;
+                case ABS_MT_TRACKING_ID:
+                    if (slot == NULL) { break; }
+                    if (ev->value == -1 && slot->active) { slot->active = 0; gs->active_finger_count--; }
+                    else if (ev->value != -1 && !slot->active) { slot->active = 1; gs->active_finger_count++; }
+                    slot->tracking_id = ev->value; send_uinput_event(uinput_fd, EV_ABS, ABS_MT_TRACKING_ID, ev->value); break;
+                case ABS_MT_POSITION_X: if (slot != NULL) { slot->x = ev->value; send_uinput_event(uinput_fd, EV_ABS, ABS_MT_POSITION_Y, passthrough_out_y(ev->value)); } break;
+                case ABS_MT_POSITION_Y: if (slot != NULL) { slot->y = ev->value; send_uinput_event(uinput_fd, EV_ABS, ABS_MT_POSITION_X, passthrough_out_x(ev->value)); } break;
+                case ABS_MT_TOUCH_MAJOR: if (slot != NULL && source_has_axis(&src_abs_major)) { send_uinput_event(uinput_fd, EV_ABS, ABS_MT_TOUCH_MAJOR, passthrough_out_major(ev->value)); } break;
+                case ABS_MT_PRESSURE: if (slot != NULL && source_has_axis(&src_abs_pressure)) { send_uinput_event(uinput_fd, EV_ABS, ABS_MT_PRESSURE, ev->value); } break;
+                case ABS_MT_TOOL_TYPE: if (slot != NULL && source_has_axis(&src_abs_tool)) { send_uinput_event(uinput_fd, EV_ABS, ABS_MT_TOOL_TYPE, ev->value); } break;
+                case ABS_X: send_uinput_event(uinput_fd, EV_ABS, ABS_Y, passthrough_out_y(ev->value)); break;
+                case ABS_Y: send_uinput_event(uinput_fd, EV_ABS, ABS_X, passthrough_out_x(ev->value)); break;
+            } break;
+        case EV_MSC: if (ev->code == MSC_TIMESTAMP) { send_uinput_event(uinput_fd, EV_MSC, MSC_TIMESTAMP, ev->value); } break;
+        case EV_SYN:
+            if (ev->code != SYN_REPORT) { break; }
+            if (gs->active_finger_count != *reported_count) { // Touchscreens don't send BTN_TOOL_*; derive them from the slot count
+                int old_tool = btn_tool_for_count(*reported_count); int new_tool = btn_tool_for_count(gs->active_finger_count);
+                if (old_tool != new_tool) { if (old_tool != -1) { send_uinput_event(uinput_fd, EV_KEY, old_tool, 0); } if (new_tool != -1) { send_uinput_event(uinput_fd, EV_KEY, new_tool, 1); } }
+                if ((*reported_count > 0) != (gs->active_finger_count > 0)) { send_uinput_event(uinput_fd, EV_KEY, BTN_TOUCH, gs->active_finger_count > 0); }
+                *reported_count = gs->active_finger_count;
+            }
+            send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); // Hands the whole frame to the I/O backend
+            shm_state_publish(shm_state, gs, &ev->time);
+            break;
+    }
+}
+
+// --- Absolute Region Mapping ---
+// In OUTPUT_MODE_ABSOLUTE the virtual device is a tablet-style absolute pointer (ABS_X/ABS_Y in desktop pixels, buttons, wheel)
+// and the screenpad is a map of the external monitor: the single-finger path sends the finger's rotated position once per frame,
+// so the cursor lands on the matching spot in one event. The pad is split into columns (in output orientation), one per target
+// rectangle left to right, each as wide as its share of the targets' summed width, so every pixel spans the same pad distance. Taps, drags, long press and pinch work as in gestures mode.
+#define ABS_TARGET_MAX 8
+typedef struct { int w; int h; int x; int y; } AbsRect;
+AbsRect abs_desktop = { 32768, 32768, 0, 0 }; // Without --desktop the axes are a unit square the compositor stretches over its screens
+AbsRect abs_targets[ABS_TARGET_MAX]; int abs_target_count = 0; int abs_sent_x = -1; int abs_sent_y = -1;
+int parse_abs_rect(const char *spec, AbsRect *r, int with_offset) { char tail; r->x = 0; r->y = 0; if (with_offset) { return (sscanf(spec, "%dx%d+%d+%d%c", &r->w, &r->h, &r->x, &r->y, &tail) == 4 && r->w > 0 && r->h > 0 && r->x >= 0 && r->y >= 0) ? 0 : -1; } return (sscanf(spec, "%dx%d%c", &r->w, &r->h, &tail) == 2 && r->w > 0 && r->h > 0) ? 0 : -1; }
+int setup_uinput_tablet() {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK); if (fd == -1) { perror("[ERROR] Cannot open /dev/uinput"); fprintf(stderr, ">>> Ensure 'uinput' kernel module is loaded and you have write permissions.\n"); return -1; }
+    const unsigned short keys[] = { BTN_LEFT, BTN_RIGHT, KEY_LEFTCTRL }; size_t i;
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1 || ioctl(fd, UI_SET_EVBIT, EV_ABS) == -1 || ioctl(fd, UI_SET_EVBIT, EV_REL) == -1 || ioctl(fd, UI_SET_EVBIT, EV_SYN) == -1) goto error;
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) { if (ioctl(fd, UI_SET_KEYBIT, keys[i]) == -1) goto error; }
+    if (ioctl(fd, UI_SET_RELBIT, REL_WHEEL) == -1 || ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES) == -1) goto error; // Pinch zoom
+    if (setup_uinput_abs_axis(fd, ABS_X, 0, abs_desktop.w - 1, 0) == -1 || setup_uinput_abs_axis(fd, ABS_Y, 0, abs_desktop.h - 1, 0) == -1) goto error;
+    struct uinput_setup usetup; memset(&usetup, 0, sizeof(usetup)); snprintf(usetup.name, UINPUT_MAX_NAME_SIZE, "Screenpad Virtual Tablet"); usetup.id.bustype = BUS_VIRTUAL; usetup.id.vendor = 0xABCD; usetup.id.product = 0xABCF; usetup.id.version = 1;
+    if (ioctl(fd, UI_DEV_SETUP, &usetup) == -1 || ioctl(fd, UI_DEV_CREATE) == -1) goto error;
+    printf("[INFO] Created virtual uinput tablet: %s (%dx%d desktop, %d target%s)\n", usetup.name, abs_desktop.w, abs_desktop.h, abs_target_count, abs_target_count == 1 ? "" : "s");
+    return fd;
+error:
+    perror("[ERROR] Failed to setup uinput tablet via ioctl"); close(fd); return -1;
+}
+// Rotated like the relative path (out_x follows +y, out_y follows -x), normalised over the EVIOCGABS range, then placed in a target
+void absolute_emit(int uinput_fd, const SlotState *slot, int *needs_sync) {
+    double u = (double)(slot->y - src_abs_y.minimum) / (src_abs_y.maximum - src_abs_y.minimum); double v = (double)(src_abs_x.maximum - slot->x) / (src_abs_x.maximum - src_abs_x.minimum);
+    if (u < 0.0) { u = 0.0; } if (u > 1.0) { u = 1.0; } if (v < 0.0) { v = 0.0; } if (v > 1.0) { v = 1.0; }
+    int column, total_w = 0, left_w = 0; for (column = 0; column < abs_target_count; ++column) { total_w += abs_targets[column].w; }
+    double px = u * total_w; for (column = 0; column < abs_target_count - 1 && px >= left_w + abs_targets[column].w; ++column) { left_w += abs_targets[column].w; }
+    const AbsRect *t = &abs_targets[column]; u = (px - left_w) / t->w; if (u > 1.0) { u = 1.0; }
+    int out_x = t->x + (int)round(u * (t->w - 1)); int out_y = t->y + (int)round(v * (t->h - 1));
+    if (out_x != abs_sent_x) { send_uinput_event(uinput_fd, EV_ABS, ABS_X, out_x); abs_sent_x = out_x; *needs_sync = 1; }
+    if (out_y != abs_sent_y) { send_uinput_event(uinput_fd, EV_ABS, ABS_Y, out_y); abs_sent_y = out_y; *needs_sync = 1; }
+}
+
+// --- Self-Profiling (--profile) ---
+// Counters for this thread from perf_event_open. Where the PMU allows user-space reads (rdpmc through the perf mmap page), every
+// counter is split into decode (per-event slot/axis updates), gesture (SYN_REPORT frame logic and timers) and emission (frame
+// writes to uinput) without a syscall per phase change; otherwise only whole batches are measured. Time spent waiting for
+// input is not attributed. The per-frame breakdown is printed on exit and on SIGUSR1.
+typedef enum { PROFILE_IDLE, PROFILE_DECODE, PROFILE_GESTURE, PROFILE_EMIT, PROFILE_PHASE_COUNT } ProfilePhase;
+const char *PROFILE_PHASE_NAMES[PROFILE_PHASE_COUNT] = { "idle", "decode", "gesture", "emit" };
+#define PROFILE_COUNTER_COUNT 6
+#define PROFILE_CALIBRATION_ROUNDS 8
+#define PROFILE_CALIBRATION_READS 16
+#define PROFILE_CTX_SWITCHES 4 // Software counters: no rdpmc, so the fast path reads them once per batch
+#define PROFILE_TASK_CLOCK 5
+typedef struct { const char *name; uint32_t type; uint64_t config; } ProfileCounter;
+const ProfileCounter PROFILE_COUNTERS[PROFILE_COUNTER_COUNT] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES }, { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }, { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "ctx-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }, { "task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+typedef struct {
+    int group_fd; int fds[PROFILE_COUNTER_COUNT]; int index[PROFILE_COUNTER_COUNT]; int nr; int user_only; // index: position in the group read, -1 if unavailable
+    int fast; struct perf_event_mmap_page *pages[PROFILE_COUNTER_COUNT]; // fast: hardware counters by rdpmc, task clock from the leader's time_running
+    ProfilePhase phase; uint64_t last[PROFILE_COUNTER_COUNT]; uint64_t time_enabled; uint64_t time_running;
+    unsigned long long totals[PROFILE_PHASE_COUNT][PROFILE_COUNTER_COUNT]; unsigned long long intervals[PROFILE_PHASE_COUNT];
+    unsigned long long busy[PROFILE_COUNTER_COUNT]; unsigned long long busy_intervals; // Whole batches (leaving idle to re-entering it)
+    double read_cost[PROFILE_COUNTER_COUNT]; // What one read adds to each counter; subtracted once per attributed interval
+    unsigned long long frames;
+} Profile;
+Profile profile = { .group_fd = -1 };
+volatile sig_atomic_t profile_dump_requested = 0;
+int profile_emit_queued_only = 0; // io_uring: emit only queues into the ring, the write itself happens in the next wait
+
+// One syscall for the whole group. In fast mode the task clock is taken from the leader's time_running, like the fast read.
+int profile_read_group(uint64_t *out) {
+    uint64_t buf[3 + PROFILE_COUNTER_COUNT]; int c; // { nr, time_enabled, time_running, values[nr] }
+    if (read(profile.group_fd, buf, sizeof(buf)) < (ssize_t)((3 + profile.nr) * sizeof(uint64_t))) { return -1; }
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { out[c] = profile.index[c] >= 0 ? buf[3 + profile.index[c]] : 0; }
+    profile.time_enabled = buf[1]; profile.time_running = buf[2]; if (profile.fast) { out[PROFILE_TASK_CLOCK] = buf[2]; } return 0;
+}
+#if defined(__x86_64__) || defined(__i386__)
+uint64_t profile_rdpmc(uint32_t counter) { uint32_t lo, hi; __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter)); return lo | ((uint64_t)hi << 32); }
+uint64_t profile_rdtsc() { uint32_t lo, hi; __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi)); return lo | ((uint64_t)hi << 32); }
+// Self-monitoring read of one counter through its mmap page (the seqlock protocol in linux/perf_event.h). Fails while the
+// counter is not on a PMC (multiplexed out), and then the caller falls back to the group read.
+int profile_read_page(const struct perf_event_mmap_page *pc, uint64_t *value, uint64_t *running) {
+    uint32_t seq, idx; uint64_t count, run;
+    do {
+        seq = __atomic_load_n(&pc->lock, __ATOMIC_ACQUIRE);
+        idx = pc->index; if (!pc->cap_user_rdpmc || idx == 0) { return -1; }
+        int64_t pmc = (int64_t)profile_rdpmc(idx - 1); pmc <<= 64 - pc->pmc_width; pmc >>= 64 - pc->pmc_width; count = pc->offset + (uint64_t)pmc; run = pc->time_running;
+        if (running != NULL) { uint64_t cyc = profile_rdtsc(); uint64_t quot = cyc >> pc->time_shift; uint64_t rem = cyc & (((uint64_t)1 << pc->time_shift) - 1); run += pc->time_offset + quot * pc->time_mult + ((rem * pc->time_mult) >> pc->time_shift); }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&pc->lock, __ATOMIC_ACQUIRE) != seq);
+    *value = count; if (running != NULL) { *running = run; } return 0;
+}
+int profile_read_fast(uint64_t *out) {
+    int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { out[c] = profile.last[c]; }
+    for (c = 0; c < PROFILE_CTX_SWITCHES; ++c) { if (profile.pages[c] != NULL && profile_read_page(profile.pages[c], &out[c], c == 0 ? &out[PROFILE_TASK_CLOCK] : NULL) == -1) { return -1; } }
+    return 0;
+}
+#else
+int profile_read_fast(uint64_t *out) { (void)out; return -1; }
+#endif
+// Adds the deltas since the last read to `phase` (idle is never reported); a context-switch delta goes to the busy total instead
+// when ctx_busy is set, since the fast path only learns it at the batch boundary.
+void profile_charge(ProfilePhase phase, const uint64_t *now, int ctx_busy) {
+    int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { uint64_t d = now[c] - profile.last[c]; if (c == PROFILE_CTX_SWITCHES && profile.fast) { if (ctx_busy) { profile.busy[c] += d; } } else { profile.totals[phase][c] += d; } profile.last[c] = now[c]; }
+    profile.intervals[phase]++;
+}
+// Charges everything counted since the last switch to the phase being left; returns that phase so callers can restore it.
+// With rdpmc every phase change is a few instructions in user space. Without it the counters are read only when a batch starts
+// and ends (next to the wait syscall anyway), so per-event syscalls don't pollute the caches and branch predictors being measured,
+// and only the batch total is known.
+ProfilePhase profile_switch(ProfilePhase phase) {
+    ProfilePhase prev = profile.phase; uint64_t now[PROFILE_COUNTER_COUNT]; int c;
+    if (profile.group_fd < 0 || phase == prev) { return prev; }
+    profile.phase = phase;
+    if (prev == PROFILE_IDLE) { // Batch starts: drop what the wait counted, then take the baseline in user space if we can
+        if (profile_read_group(now) == 0) { profile_charge(PROFILE_IDLE, now, 0); }
+        if (profile.fast && profile_read_fast(now) == 0) { profile_charge(PROFILE_IDLE, now, 0); }
+        return prev;
+    }
+    if (profile.fast) {
+        if (profile_read_fast(now) == 0 || profile_read_group(now) == 0) { profile_charge(prev, now, 1); }
+        if (phase == PROFILE_IDLE && profile_read_group(now) == 0) { profile_charge(PROFILE_IDLE, now, 1); profile.busy_intervals++; } // Batch ends: context switches
+        return prev;
+    }
+    if (phase == PROFILE_IDLE && profile_read_group(now) == 0) { for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { profile.busy[c] += now[c] - profile.last[c]; profile.last[c] = now[c]; } profile.busy_intervals++; }
+    return prev;
+}
+// Maps each hardware counter's page and keeps the fast path only if every one of them, and the leader's clock, can be read
+// from user space.
+void profile_setup_fast() {
+#if defined(__x86_64__) || defined(__i386__)
+    long page = sysconf(_SC_PAGESIZE); int c;
+    profile.fast = profile.index[0] == 0; // The leader must be cycles: its time_running is the task clock
+    for (c = 0; c < PROFILE_CTX_SWITCHES && profile.fast; ++c) {
+        if (profile.index[c] < 0) { continue; }
+        void *p = mmap(NULL, (size_t)page, PROT_READ, MAP_SHARED, profile.fds[c], 0); if (p == MAP_FAILED) { profile.fast = 0; break; }
+        profile.pages[c] = p; if (!profile.pages[c]->cap_user_rdpmc || (c == 0 && !profile.pages[c]->cap_user_time)) { profile.fast = 0; }
+    }
+    uint64_t probe[PROFILE_COUNTER_COUNT]; if (profile.fast && profile_read_fast(probe) == -1) { profile.fast = 0; }
+    if (!profile.fast) { long pg = page; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.pages[c] != NULL) { munmap(profile.pages[c], (size_t)pg); profile.pages[c] = NULL; } } }
+#endif
+}
+int profile_open() {
+    struct perf_event_attr attr; int c, user_only;
+    for (user_only = 0; user_only <= 1 && profile.group_fd < 0; ++user_only) { // Retry without kernel counting if perf_event_paranoid forbids it
+        profile.nr = 0;
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) {
+            memset(&attr, 0, sizeof(attr)); attr.size = sizeof(attr); attr.type = PROFILE_COUNTERS[c].type; attr.config = PROFILE_COUNTERS[c].config;
+            attr.disabled = (profile.group_fd < 0); attr.exclude_hv = 1; attr.exclude_kernel = user_only;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            profile.fds[c] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, profile.group_fd, PERF_FLAG_FD_CLOEXEC); profile.index[c] = -1;
+            if (profile.fds[c] == -1) { continue; }
+            if (profile.group_fd < 0) { profile.group_fd = profile.fds[c]; }
+            profile.index[c] = profile.nr++;
+        }
+        profile.user_only = user_only;
+    }
+    if (profile.group_fd < 0) { fprintf(stderr, "[ERROR] perf_event_open failed: %s (see /proc/sys/kernel/perf_event_paranoid).\n", strerror(errno)); return -1; }
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.index[c] < 0) { fprintf(stderr, "[WARN] Counter '%s' is not available on this machine.\n", PROFILE_COUNTERS[c].name); } }
+    if (ioctl(profile.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) { perror("[ERROR] Cannot enable perf counters"); return -1; }
+    profile_setup_fast();
+    // Calibrate the cost of a read so that phases entered many times per frame are not inflated by the measurement itself.
+    // The cheapest of several rounds is kept: a round that got preempted or faulted says nothing about the steady state.
+    uint64_t first[PROFILE_COUNTER_COUNT]; int round, r;
+    for (round = 0; round < PROFILE_CALIBRATION_ROUNDS; ++round) {
+        if (profile_read_group(first) == -1) { perror("[ERROR] Cannot read perf counters"); return -1; }
+        if (profile.fast) { profile_read_fast(first); }
+        for (r = 0; r < PROFILE_CALIBRATION_READS; ++r) { if (profile.fast) { profile_read_fast(profile.last); } else { profile_read_group(profile.last); } }
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double cost = (double)(profile.last[c] - first[c]) / PROFILE_CALIBRATION_READS; if (round == 0 || cost < profile.read_cost[c]) { profile.read_cost[c] = cost; } }
+    }
+    profile_read_group(profile.last); profile.phase = PROFILE_IDLE;
+    printf("[INFO] Profiling with perf counters (%s, %s).\n", profile.user_only ? "user space only" : "user + kernel", profile.fast ? "rdpmc: per-phase breakdown" : "no rdpmc: batch totals only");
+    return 0;
+}
+void profile_print_row(const char *label, const double *v) {
+    int c; printf("[PROFILE] %-8s", label);
+    for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.index[c] < 0 || isnan(v[c])) { printf(" %14s", "n/a"); } else { printf(c == PROFILE_CTX_SWITCHES ? " %14.4f" : " %14.1f", v[c]); } }
+    if (profile.index[0] >= 0 && profile.index[1] >= 0 && v[0] > 0) { printf(" %6.2f", v[1] / v[0]); }
+    printf("\n");
+}
+void profile_print() {
+    double row[PROFILE_COUNTER_COUNT], total[PROFILE_COUNTER_COUNT] = {0}; unsigned long long reads = 0; int p, c;
+    if (profile.group_fd < 0) { return; }
+    ProfilePhase phase = profile_switch(PROFILE_IDLE); profile_switch(phase); // Bring the totals up to date
+    double frames = profile.frames ? (double)profile.frames : 1.0;
+    printf("[PROFILE] %llu input frames, %s, per frame:\n", profile.frames, profile.user_only ? "user space only" : "user + kernel");
+    printf("[PROFILE] %-8s", "phase"); for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { printf(" %14s", PROFILE_COUNTERS[c].name); } printf(" %6s\n", "IPC");
+    if (profile.fast) {
+        for (p = PROFILE_DECODE; p < PROFILE_PHASE_COUNT; ++p) {
+            for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double v = (double)profile.totals[p][c] - profile.intervals[p] * profile.read_cost[c]; row[c] = (v > 0 ? v : 0) / frames; total[c] += row[c]; }
+            row[PROFILE_CTX_SWITCHES] = NAN; profile_print_row(PROFILE_PHASE_NAMES[p], row); reads += profile.intervals[p];
+        }
+        total[PROFILE_CTX_SWITCHES] = profile.busy[PROFILE_CTX_SWITCHES] / frames; profile_print_row("total", total);
+        printf("[PROFILE] %.1f rdpmc reads per frame (~%.0f cycles each) are already subtracted; context switches are counted per batch.\n", reads / frames, profile.read_cost[0]);
+    } else {
+        for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { double v = (double)profile.busy[c] - profile.busy_intervals * profile.read_cost[c]; total[c] = (v > 0 ? v : 0) / frames; }
+        profile_print_row("total", total);
+        printf("[PROFILE] No user-space counter access (rdpmc), so only batch totals are measured; a per-phase split would need a syscall per event.\n");
+    }
+    if (profile.time_running < profile.time_enabled) { printf("[PROFILE] Counters were multiplexed (running %.0f%% of the time); values are not scaled.\n", 100.0 * profile.time_running / profile.time_enabled); }
+    if (profile_emit_queued_only) { printf("[PROFILE] With io_uring, emit only queues frames into the ring; the uinput write runs inside the next io_uring_enter wait (or the SQPOLL thread) and is not attributed.\n"); }
+    fflush(stdout);
+}
+void profile_close() { int c; for (c = 0; c < PROFILE_COUNTER_COUNT; ++c) { if (profile.pages[c] != NULL) { munmap(profile.pages[c], (size_t)sysconf(_SC_PAGESIZE)); profile.pages[c] = NULL; } if (profile.index[c] >= 0) { close(profile.fds[c]); } } profile.group_fd = -1; profile.fast = 0; }
+
+// --- I/O Backends ---
+// The event loop reads evdev events in batches and writes uinput output one frame (up to SYN_REPORT) at a time
+// through one of these backends, selected at runtime with --io=<name>.
+typedef struct { unsigned long long reads; unsigned long long writes; unsigned long long polls; unsigned long long enters; } IoStats;
+typedef struct {
+    const char *name;
+    int  (*init)(int in_fd, int out_fd);
+    int  (*read_events)(struct input_event *buf, int max, long long timeout_us); // Waits up to timeout_us (-1: forever) for events. Returns count, 0 on timeout, -1 on error/EOF (errno set)
+    int  (*write_frame)(const struct input_event *evs, int count);
+    void (*flush)(void);                                             // Make sure every queued frame has reached the kernel
+    void (*destroy)(void);
+} IoBackend;
+IoStats io_stats = {0};
+const sigset_t *io_wait_sigmask = NULL; // Signal mask installed only while a backend blocks for input (NULL: leave the mask alone)
+
+// Default backend: nonblocking read() of a whole batch, poll() when empty, one write() per frame.
+int rw_in_fd = -1; int rw_out_fd = -1;
+int rw_init(int in_fd, int out_fd) { rw_in_fd = in_fd; rw_out_fd = out_fd; return 0; }
+int rw_read_events(struct input_event *buf, int max, long long timeout_us) {
+    struct timespec timeout = { .tv_sec = timeout_us / 1000000, .tv_nsec = (timeout_us % 1000000) * 1000 };
+    while (1) {
+        ssize_t n = read(rw_in_fd, buf, (size_t)max * sizeof(struct input_event)); io_stats.reads++;
+        if (n > 0) { if (n % sizeof(struct input_event) != 0) { fprintf(stderr, "\n[WARN] Read %ld bytes (not a multiple of %ld). Dropping the partial event.\n", (long)n, (long)sizeof(struct input_event)); } return (int)(n / sizeof(struct input_event)); }
+        if (n == 0) { errno = ENODEV; return -1; }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) { return -1; }
+        struct pollfd pfd = { .fd = rw_in_fd, .events = POLLIN, .revents = 0 };
+        io_stats.polls++;
+        int ready = ppoll(&pfd, 1, timeout_us < 0 ? NULL : &timeout, io_wait_sigmask); // ppoll: gesture deadlines need better than 1 ms; the mask lets stop signals in only here
+        if (ready == -1) { return -1; }
+        if (ready == 0) { return 0; }
+    }
+}
+int rw_write_frame(const struct input_event *evs, int count) { ssize_t n = write(rw_out_fd, evs, (size_t)count * sizeof(struct input_event)); io_stats.writes++; if (n != (ssize_t)(count * sizeof(struct input_event))) { fprintf(stderr, "[ERROR] Failed to write %d-event frame to uinput device: %s\n", count, n == -1 ? strerror(errno) : "short write"); return -1; } return 0; }
+void rw_flush(void) {}
+void rw_destroy(void) { rw_in_fd = -1; rw_out_fd = -1; }
+const IoBackend io_backend_read = { "read", rw_init, rw_read_events, rw_write_frame, rw_flush, rw_destroy };
+
+// io_uring backend: a read is always posted on the evdev fd, and uinput frames queued between two waits are coalesced into one
+// write SQE that goes out with the io_uring_enter() the loop makes anyway to wait for input (under SQPOLL each frame is queued
+// immediately and the poller thread picks it up with no syscall at all). Writes use IOSQE_CQE_SKIP_SUCCESS, so a successful
+// write never wakes the loop; only failures post a completion. Both fds are O_NONBLOCK, so the kernel issues each write inline
+// when it consumes the SQE: SQEs are consumed in order, and a write buffer is free again once the SQ head has moved past it.
+#define URING_ENTRIES 16
+#define URING_SQPOLL_IDLE_MS 2000
+#define URING_WRITE_SLOTS 8
+#define URING_WRITE_MAX_EVENTS (4 * OUT_FRAME_MAX)
+#define URING_UD_READ 1
+#define URING_UD_WRITE 2
+typedef struct {
+    int ring_fd; int in_fd; int out_fd; int sqpoll;
+    unsigned *sq_head; unsigned *sq_tail; unsigned *sq_mask; unsigned *sq_flags; unsigned *sq_array; unsigned sq_entries; unsigned sq_local_tail; unsigned to_submit;
+    unsigned *cq_head; unsigned *cq_tail; unsigned *cq_mask; struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes; void *sq_ptr; size_t sq_map_size; void *cq_ptr; size_t cq_map_size; size_t sqes_map_size;
+    struct input_event read_buf[EVENT_BATCH_MAX]; int read_ready; int read_result; int read_pos; int read_count; // [read_pos, read_count): completed but not yet handed out
+    struct input_event write_bufs[URING_WRITE_SLOTS][URING_WRITE_MAX_EVENTS]; unsigned write_sq_pos[URING_WRITE_SLOTS]; int write_used[URING_WRITE_SLOTS]; int write_slot; int pending_count;
+} UringState;
+UringState uring = { .ring_fd = -1 };
+int uring_sqpoll_requested = 0;
+
+struct io_uring_sqe* uring_get_sqe() { unsigned head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE); if (uring.sq_local_tail - head >= uring.sq_entries) { return NULL; } unsigned idx = uring.sq_local_tail & *uring.sq_mask; struct io_uring_sqe *sqe = &uring.sqes[idx]; memset(sqe, 0, sizeof(*sqe)); uring.sq_array[idx] = idx; return sqe; }
+void uring_commit_sqe() { uring.sq_local_tail++; uring.to_submit++; __atomic_store_n(uring.sq_tail, uring.sq_local_tail, __ATOMIC_RELEASE); }
+// Submits whatever is queued and optionally waits (up to timeout_us, -1: forever) for completions; a timeout fails with ETIME.
+// Under SQPOLL this only enters the kernel to wake the poller or to wait.
+int uring_enter(unsigned min_complete, long long timeout_us) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0; unsigned to_submit = uring.to_submit;
+    struct __kernel_timespec ts = { .tv_sec = timeout_us / 1000000, .tv_nsec = (timeout_us % 1000000) * 1000 };
+    struct io_uring_getevents_arg arg; memset(&arg, 0, sizeof(arg)); arg.ts = timeout_us >= 0 ? (unsigned long long)(unsigned long)&ts : 0;
+    if (io_wait_sigmask != NULL) { arg.sigmask = (unsigned long long)(unsigned long)io_wait_sigmask; arg.sigmask_sz = _NSIG / 8; } // Like ppoll: swapped in for the wait only
+    if (uring.sqpoll) { to_submit = 0; uring.to_submit = 0; if (__atomic_load_n(uring.sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) { flags |= IORING_ENTER_SQ_WAKEUP; } }
+    if (to_submit == 0 && flags == 0) { return 0; }
+    io_stats.enters++;
+    int ret = (min_complete && (timeout_us >= 0 || io_wait_sigmask != NULL)) ? (int)syscall(__NR_io_uring_enter, uring.ring_fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) : (int)syscall(__NR_io_uring_enter, uring.ring_fd, to_submit, min_complete, flags, NULL, 0);
+    if (ret == -1) { return -1; }
+    if (!uring.sqpoll) { uring.to_submit -= (unsigned)ret; }
+    return 0;
+}
+int uring_post_read() { struct io_uring_sqe *sqe = uring_get_sqe(); if (sqe == NULL) { return -1; } sqe->opcode = IORING_OP_READ; sqe->fd = uring.in_fd; sqe->addr = (unsigned long)uring.read_buf; sqe->len = sizeof(uring.read_buf); sqe->off = (unsigned long long)-1; sqe->user_data = URING_UD_READ; uring_commit_sqe(); return 0; }
+// Waits until the kernel has consumed the SQE that last used `slot`, so its buffer can be refilled.
+int uring_wait_write_slot(int slot) { while (uring.write_used[slot] && (int)(__atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) - uring.write_sq_pos[slot]) <= 0) { if (uring_enter(0, -1) == -1 && errno != EINTR) { return -1; } if (uring.sqpoll) { sched_yield(); } } uring.write_used[slot] = 0; return 0; }
+int uring_queue_pending_write() {
+    if (uring.pending_count == 0) { return 0; }
+    struct io_uring_sqe *sqe = uring_get_sqe(); if (sqe == NULL) { if (uring_enter(0, -1) == -1) { return -1; } sqe = uring_get_sqe(); if (sqe == NULL) { return -1; } }
+    int slot = uring.write_slot;
+    sqe->opcode = IORING_OP_WRITE; sqe->flags = IOSQE_CQE_SKIP_SUCCESS; sqe->fd = uring.out_fd; sqe->addr = (unsigned long)uring.write_bufs[slot]; sqe->len = (unsigned)uring.pending_count * sizeof(struct input_event); sqe->off = (unsigned long long)-1; sqe->user_data = URING_UD_WRITE;
+    uring.write_sq_pos[slot] = uring.sq_local_tail; uring.write_used[slot] = 1; uring_commit_sqe(); io_stats.writes++;
+    uring.pending_count = 0; uring.write_slot = (slot + 1) % URING_WRITE_SLOTS;
+    return uring_wait_write_slot(uring.write_slot);
+}
+void uring_reap() {
+    unsigned head = *uring.cq_head; unsigned tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+        if (cqe->user_data == URING_UD_READ) { uring.read_ready = 1; uring.read_result = cqe->res; }
+        else if (cqe->user_data == URING_UD_WRITE) { fprintf(stderr, "[ERROR] Failed to write frame to uinput device: %s\n", cqe->res < 0 ? strerror(-cqe->res) : "short write"); } // Only failures complete
+        head++;
+    }
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+int uring_init(int in_fd, int out_fd) {
+    struct io_uring_params p; memset(&p, 0, sizeof(p));
+    if (uring_sqpoll_requested) { p.flags |= IORING_SETUP_SQPOLL; p.sq_thread_idle = URING_SQPOLL_IDLE_MS; }
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd == -1) { fprintf(stderr, "[WARN] io_uring_setup failed: %s\n", strerror(errno)); return -1; }
+    if (!(p.features & IORING_FEAT_CQE_SKIP) || !(p.features & IORING_FEAT_EXT_ARG)) { fprintf(stderr, "[WARN] io_uring lacks IOSQE_CQE_SKIP_SUCCESS or timed waits (needs Linux 5.17+).\n"); close(fd); return -1; }
+    uring.ring_fd = fd; uring.in_fd = in_fd; uring.out_fd = out_fd; uring.sqpoll = uring_sqpoll_requested;
+    uring.sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned); uring.cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) { if (uring.cq_map_size > uring.sq_map_size) { uring.sq_map_size = uring.cq_map_size; } uring.cq_map_size = uring.sq_map_size; }
+    uring.sq_ptr = mmap(NULL, uring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (uring.sq_ptr == MAP_FAILED) { goto error; }
+    uring.cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? uring.sq_ptr : mmap(NULL, uring.cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (uring.cq_ptr == MAP_FAILED) { goto error; }
+    uring.sqes_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    uring.sqes = mmap(NULL, uring.sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (uring.sqes == MAP_FAILED) { goto error; }
+    uring.sq_head = (unsigned *)((char *)uring.sq_ptr + p.sq_off.head); uring.sq_tail = (unsigned *)((char *)uring.sq_ptr + p.sq_off.tail); uring.sq_mask = (unsigned *)((char *)uring.sq_ptr + p.sq_off.ring_mask); uring.sq_flags = (unsigned *)((char *)uring.sq_ptr + p.sq_off.flags); uring.sq_array = (unsigned *)((char *)uring.sq_ptr + p.sq_off.array);
+    uring.cq_head = (unsigned *)((char *)uring.cq_ptr + p.cq_off.head); uring.cq_tail = (unsigned *)((char *)uring.cq_ptr + p.cq_off.tail); uring.cq_mask = (unsigned *)((char *)uring.cq_ptr + p.cq_off.ring_mask); uring.cqes = (struct io_uring_cqe *)((char *)uring.cq_ptr + p.cq_off.cqes);
+    uring.sq_entries = p.sq_entries; uring.sq_local_tail = *uring.sq_tail; uring.to_submit = 0;
+    uring.read_ready = 0; uring.pending_count = 0; uring.write_slot = 0; memset(uring.write_used, 0, sizeof(uring.write_used));
+    if (uring_post_read() == -1 || uring_enter(0, -1) == -1) { goto error; }
+    printf("[INFO] io_uring backend ready%s.\n", uring.sqpoll ? " (SQPOLL)" : "");
+    return 0;
+error:
+    fprintf(stderr, "[WARN] Failed to set up io_uring rings: %s\n", strerror(errno));
+    if (uring.sqes != NULL && uring.sqes != MAP_FAILED) { munmap(uring.sqes, uring.sqes_map_size); }
+    if (uring.cq_ptr != NULL && uring.cq_ptr != MAP_FAILED && uring.cq_ptr != uring.sq_ptr) { munmap(uring.cq_ptr, uring.cq_map_size); }
+    if (uring.sq_ptr != NULL && uring.sq_ptr != MAP_FAILED) { munmap(uring.sq_ptr, uring.sq_map_size); }
+    close(fd); memset(&uring, 0, sizeof(uring)); uring.ring_fd = -1;
+    return -1;
+}
+// Hands out up to max completed events. The buffer is only re-armed once it is drained, so a caller asking for less than a
+// full read (the palm filter holding back a partial frame) gets the rest on the next call instead of losing it.
+int uring_take_read(struct input_event *buf, int max) {
+    int count = uring.read_count - uring.read_pos; if (count > max) { count = max; }
+    memcpy(buf, &uring.read_buf[uring.read_pos], (size_t)count * sizeof(struct input_event)); uring.read_pos += count;
+    if (uring.read_pos == uring.read_count && uring_post_read() == -1) { return -1; } // Re-arm before returning; it is submitted with the next enter
+    return count;
+}
+int uring_read_events(struct input_event *buf, int max, long long timeout_us) {
+    if (uring.read_pos < uring.read_count) { return uring_take_read(buf, max); }
+    long long deadline_ns = timeout_us < 0 ? -1 : monotonic_ns() + timeout_us * 1000;
+    while (1) {
+        uring_reap();
+        if (uring.read_ready) {
+            int res = uring.read_result; uring.read_ready = 0;
+            if (res == -EINTR || res == -EAGAIN) { if (uring_post_read() == -1) { return -1; } continue; }
+            if (res < 0) { errno = -res; return -1; }
+            if (res == 0) { errno = ENODEV; return -1; }
+            uring.read_pos = 0; uring.read_count = res / (int)sizeof(struct input_event); return uring_take_read(buf, max);
+        }
+        if (uring_queue_pending_write() == -1) { return -1; } // The frames produced by the last batch ride along with this wait
+        long long remaining_us = deadline_ns < 0 ? -1 : (deadline_ns - monotonic_ns()) / 1000; if (deadline_ns >= 0 && remaining_us < 0) { remaining_us = 0; }
+        if (uring_enter(1, remaining_us) == -1) { if (errno == ETIME) { uring_reap(); if (!uring.read_ready) { return 0; } } else { return -1; } } // EINTR included: the loop checks for stop/dump requests
+    }
+}
+int uring_write_frame(const struct input_event *evs, int count) {
+    if (uring.pending_count + count > URING_WRITE_MAX_EVENTS && uring_queue_pending_write() == -1) { return -1; }
+    memcpy(&uring.write_bufs[uring.write_slot][uring.pending_count], evs, (size_t)count * sizeof(struct input_event)); uring.pending_count += count;
+    if (uring.sqpoll) { return uring_queue_pending_write(); }
+    return 0;
+}
+void uring_flush(void) { if (uring.ring_fd == -1) { return; } if (uring_queue_pending_write() == -1) { return; } while ((int)(__atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) - uring.sq_local_tail) < 0) { if (uring_enter(0, -1) == -1 && errno != EINTR) { break; } if (uring.sqpoll) { sched_yield(); } } uring_reap(); }
+void uring_destroy(void) { if (uring.ring_fd == -1) { return; } munmap(uring.sqes, uring.sqes_map_size); if (uring.cq_ptr != uring.sq_ptr) { munmap(uring.cq_ptr, uring.cq_map_size); } munmap(uring.sq_ptr, uring.sq_map_size); close(uring.ring_fd); memset(&uring, 0, sizeof(uring)); uring.ring_fd = -1; }
+const IoBackend io_backend_uring = { "uring", uring_init, uring_read_events, uring_write_frame, uring_flush, uring_destroy };
+
+const IoBackend *io_backend = &io_backend_read;
+// Accepts "read" (default), "uring" and "uring-sqpoll".
+const IoBackend* select_io_backend(const char *name) { if (strcmp(name, "read") == 0) { return &io_backend_read; } if (strcmp(name, "uring") == 0) { uring_sqpoll_requested = 0; return &io_backend_uring; } if (strcmp(name, "uring-sqpoll") == 0) { uring_sqpoll_requested = 1; return &io_backend_uring; } return NULL; }
+int flush_uinput_frame(int fd) { (void)fd; if (out_frame_len == 0) { return 0; } ProfilePhase phase = profile_switch(PROFILE_EMIT); int ret = io_backend->write_frame(out_frame, out_frame_len); out_frame_len = 0; profile_switch(phase); return ret; }
+void print_io_stats() { printf("[INFO] I/O backend '%s'%s: %llu read, %llu poll, %llu write, %llu io_uring_enter.\n", io_backend->name, (io_backend == &io_backend_uring && uring_sqpoll_requested) ? " (SQPOLL)" : "", io_stats.reads, io_stats.polls, io_stats.writes, io_stats.enters); }
+
+// --- I/O Benchmark (--bench-io) ---
+// Reproducible, device-free comparison of the backends: a producer process writes BENCH_FRAMES synthetic MT frames into a pipe
+// at a fixed rate, the selected backend reads them and answers every SYN_REPORT with a REL frame into a second pipe, and a sink
+// process timestamps each answer. Reports end-to-end latency, CPU time of the handler process and syscall counts per frame.
+#define BENCH_FRAMES 5000
+#define BENCH_INTERVAL_US 1000
+int compare_long_long(const void *a, const void *b) { long long x = *(const long long *)a, y = *(const long long *)b; return (x > y) - (x < y); }
+int run_io_benchmark() {
+    int in_pipe[2], out_pipe[2]; int i;
+    long long *latencies = mmap(NULL, BENCH_FRAMES * sizeof(long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latencies == MAP_FAILED) { perror("[ERROR] Cannot map benchmark results"); return EXIT_FAILURE; }
+    long long *seen = mmap(NULL, sizeof(long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (seen == MAP_FAILED) { perror("[ERROR] Cannot map benchmark results"); return EXIT_FAILURE; }
+    if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1) { perror("[ERROR] Cannot create benchmark pipes"); return EXIT_FAILURE; }
+    pid_t sink = fork();
+    if (sink == 0) { // Sink: stands in for uinput, records when each answer frame arrives
+        close(in_pipe[0]); close(in_pipe[1]); close(out_pipe[1]);
+        struct input_event evs[EVENT_BATCH_MAX]; ssize_t n; long long count = 0;
+        while ((n = read(out_pipe[0], evs, sizeof(evs))) > 0) { long long now = monotonic_ns(); for (i = 0; i < (int)(n / sizeof(struct input_event)); ++i) { if (evs[i].type == EV_SYN && count < BENCH_FRAMES) { latencies[count++] = now - ((long long)evs[i].time.tv_sec * 1000000000LL + (long long)evs[i].time.tv_usec * 1000LL); } } }
+        *seen = count; _exit(0);
+    }
+    pid_t producer = fork();
+    if (producer == 0) { // Producer: stands in for evdev, one finger sweeping at a fixed report rate
+        close(in_pipe[0]); close(out_pipe[0]); close(out_pipe[1]);
+        struct timespec next; clock_gettime(CLOCK_MONOTONIC, &next);
+        for (i = 0; i < BENCH_FRAMES; ++i) {
+            next.tv_nsec += BENCH_INTERVAL_US * 1000L; if (next.tv_nsec >= 1000000000L) { next.tv_nsec -= 1000000000L; next.tv_sec++; }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            struct input_event frame[3]; memset(frame, 0, sizeof(frame)); long long now = monotonic_ns();
+            frame[0].type = EV_ABS; frame[0].code = ABS_MT_POSITION_X; frame[0].value = 1000 + (i % 500);
+            frame[1].type = EV_ABS; frame[1].code = ABS_MT_POSITION_Y; frame[1].value = 1000 + (i % 300);
+            frame[2].type = EV_SYN; frame[2].code = SYN_REPORT;
+            frame[2].time.tv_sec = now / 1000000000LL; frame[2].time.tv_usec = (now % 1000000000LL) / 1000;
+            if (write(in_pipe[1], frame, sizeof(frame)) != sizeof(frame)) { perror("[ERROR] Benchmark producer write"); break; }
+        }
+        _exit(0);
+    }
+    close(in_pipe[1]); close(out_pipe[0]);
+    fcntl(in_pipe[0], F_SETFL, O_NONBLOCK); fcntl(out_pipe[1], F_SETFL, O_NONBLOCK); // Same open flags as the evdev/uinput pair
+    if (io_backend->init(in_pipe[0], out_pipe[1]) == -1) { fprintf(stderr, "[ERROR] Backend '%s' unavailable.\n", io_backend->name); kill(producer, SIGTERM); kill(sink, SIGTERM); return EXIT_FAILURE; }
+    memset(&io_stats, 0, sizeof(io_stats));
+    struct rusage ru_start, ru_end; getrusage(RUSAGE_SELF, &ru_start);
+    struct input_event batch[EVENT_BATCH_MAX]; long long frames = 0; int count;
+    while ((count = io_backend->read_events(batch, EVENT_BATCH_MAX, -1)) > 0) {
+        for (i = 0; i < count; ++i) {
+            if (batch[i].type != EV_SYN || batch[i].code != SYN_REPORT) { continue; }
+            struct input_event answer[3]; memset(answer, 0, sizeof(answer));
+            answer[0].type = EV_REL; answer[0].code = REL_X; answer[0].value = 1; answer[1].type = EV_REL; answer[1].code = REL_Y; answer[1].value = 1;
+            answer[2].type = EV_SYN; answer[2].code = SYN_REPORT; answer[2].time = batch[i].time; // Carry the producer stamp through to the sink
+            io_backend->write_frame(answer, 3); frames++;
+        }
+    }
+    io_backend->flush(); getrusage(RUSAGE_SELF, &ru_end);
+    IoStats stats = io_stats; io_backend->destroy(); close(in_pipe[0]); close(out_pipe[1]);
+    waitpid(producer, NULL, 0); waitpid(sink, NULL, 0);
+    long long n_lat = *seen; if (n_lat == 0) { fprintf(stderr, "[ERROR] Benchmark sink saw no frames.\n"); return EXIT_FAILURE; }
+    qsort(latencies, (size_t)n_lat, sizeof(long long), compare_long_long);
+    long long sum = 0; for (i = 0; i < n_lat; ++i) { sum += latencies[i]; }
+    double user_ms = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) * 1000.0 + (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1000.0;
+    double sys_ms = (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1000.0 + (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1000.0;
+    unsigned long long syscalls = stats.reads + stats.polls + (io_backend == &io_backend_uring ? 0 : stats.writes) + stats.enters;
+    printf("[BENCH] backend=%s%s frames=%lld/%d interval=%dus\n", io_backend->name, (io_backend == &io_backend_uring && uring_sqpoll_requested) ? "-sqpoll" : "", frames, BENCH_FRAMES, BENCH_INTERVAL_US);
+    printf("[BENCH] latency_us: mean=%.1f p50=%.1f p99=%.1f max=%.1f\n", sum / (double)n_lat / 1000.0, latencies[n_lat / 2] / 1000.0, latencies[(n_lat * 99) / 100] / 1000.0, latencies[n_lat - 1] / 1000.0);
+    printf("[BENCH] cpu_ms: user=%.1f sys=%.1f per_frame_us=%.2f\n", user_ms, sys_ms, frames ? (user_ms + sys_ms) * 1000.0 / frames : 0.0);
+    printf("[BENCH] syscalls: read=%llu poll=%llu write=%llu io_uring_enter=%llu total=%llu per_frame=%.2f\n", stats.reads, stats.polls, io_backend == &io_backend_uring ? 0ULL : stats.writes, stats.enters, syscalls, frames ? syscalls / (double)frames : 0.0);
+    munmap(latencies, BENCH_FRAMES * sizeof(long long)); munmap(seen, sizeof(long long));
+    return EXIT_SUCCESS;
+}
+
+// --- Gesture Timers ---
+// Deadlines that must act on their own, without waiting for the next input event (long press, tap/double-tap windows,
+// drag lock, click release). The table is fixed and tiny: arm/cancel are O(1), finding the next deadline is a scan of
+// TIMER_COUNT entries, and the event loop passes that deadline to the I/O backend as its wait timeout, so each timer
+// fires exactly on time without polling. Deadlines are in engine_clock microseconds, the same clock as event timestamps.
+typedef enum { TIMER_TAP_EXPIRE, TIMER_TWO_FINGER_TAP_EXPIRE, TIMER_LONG_PRESS, TIMER_DOUBLE_TAP_WINDOW, TIMER_DRAG_LOCK, TIMER_CLICK_RELEASE, TIMER_COUNT } GestureTimer;
+#define CLICK_HOLD_US 20000 // Press-to-release time of synthesized clicks
+long long timer_deadline_us[TIMER_COUNT]; // 0 = disarmed
+unsigned short click_release_button;
+long long engine_now_us; // Time the engine is acting at: the current event's timestamp, or the deadline of the timer being fired
+void timer_arm(GestureTimer t, long long deadline_us) { timer_deadline_us[t] = deadline_us > 0 ? deadline_us : 1; }
+void timer_cancel(GestureTimer t) { timer_deadline_us[t] = 0; }
+long long timer_next_deadline_us() { long long next = -1; int t; for (t = 0; t < TIMER_COUNT; ++t) { if (timer_deadline_us[t] && (next < 0 || timer_deadline_us[t] < next)) { next = timer_deadline_us[t]; } } return next; }
+
+// --- Jitter Filter ---
+// One-Euro low-pass on each slot's position, run once per frame on the frame's kernel timestamp. The cutoff rises with finger
+// speed, so a resting or creeping finger is smoothed hard while a swipe passes through without lag. Constant cost per sample
+// and no allocation; the result becomes the slot's x/y before any dead zone or delta is computed.
+double one_euro_alpha(double cutoff_hz, double dt_s) { double tau = 1.0 / (2.0 * M_PI * cutoff_hz); return 1.0 / (1.0 + tau / dt_s); }
+void jitter_filter_slot(SlotState *slot, long long t_us) {
+    if (settings->filter_min_cutoff_hz <= 0.0 || slot->filt_t_us == 0) { slot->filt_x = slot->raw_x; slot->filt_y = slot->raw_y; slot->filt_speed = 0.0; }
+    else {
+        double dt_s = (t_us - slot->filt_t_us) / 1e6; if (dt_s <= 0.0) { dt_s = 1e-3; } // Frames sharing a timestamp
+        double vx = (slot->raw_x - slot->filt_x) / dt_s; double vy = (slot->raw_y - slot->filt_y) / dt_s;
+        slot->filt_speed += one_euro_alpha(settings->filter_d_cutoff_hz, dt_s) * (sqrt(vx * vx + vy * vy) - slot->filt_speed);
+        double alpha = one_euro_alpha(settings->filter_min_cutoff_hz + settings->filter_beta * slot->filt_speed, dt_s);
+        slot->filt_x += alpha * (slot->raw_x - slot->filt_x); slot->filt_y += alpha * (slot->raw_y - slot->filt_y);
+    }
+    slot->filt_t_us = t_us; slot->x = (int)round(slot->filt_x); slot->y = (int)round(slot->filt_y);
+}
+
+// --- Pinch-to-Zoom ---
+// With exactly two fingers down, the distance between them is tracked every frame. Once it has changed by more than the pinch
+// dead zone, and by more than the pair's centre has moved (otherwise it is a two-finger pan), the gesture latches into a zoom
+// until the count changes: Ctrl is held and REL_WHEEL_HI_RES follows log2(distance / start distance), with REL_WHEEL notches
+// for clients that only read the legacy wheel. Output goes into the current frame, so zoom tracks the fingers frame by frame.
+void pinch_end(int uinput_fd, int *needs_sync) {
+    if (gesture_state.pinch_active) { printf("[INFO] Pinch Zoom End.\n"); send_uinput_event(uinput_fd, EV_KEY, KEY_LEFTCTRL, 0); *needs_sync = 1; }
+    gesture_state.pinch_tracking = 0; gesture_state.pinch_active = 0;
+}
+void pinch_frame(int uinput_fd, int *needs_sync) {
+    GestureState *gs = &gesture_state; const SlotState *a = NULL; const SlotState *b = NULL; int i;
+    for (i = 0; i < MAX_SLOTS; ++i) { if (gs->slots[i].active) { if (a == NULL) { a = &gs->slots[i]; } else { b = &gs->slots[i]; break; } } }
+    if (b == NULL) { return; }
+    double dx = b->x - a->x; double dy = b->y - a->y; double dist = sqrt(dx * dx + dy * dy); double cx = (a->x + b->x) / 2.0; double cy = (a->y + b->y) / 2.0;
+    if (!gs->pinch_tracking) { gs->pinch_tracking = 1; gs->pinch_start_dist = dist; gs->pinch_start_cx = cx; gs->pinch_start_cy = cy; gs->pinch_hires_sent = 0; gs->pinch_notches_sent = 0; return; }
+    if (gs->pinch_start_dist < 1.0 || dist < 1.0) { return; } // Fingers reported on top of each other: no meaningful scale
+    if (!gs->pinch_active) {
+        double spread = dist - gs->pinch_start_dist; double pan_x = cx - gs->pinch_start_cx; double pan_y = cy - gs->pinch_start_cy;
+        if (spread * spread <= settings->dead_zone_threshold_sq_pinch || spread * spread <= pan_x * pan_x + pan_y * pan_y) { return; } // Still a tap, or a pan
+        printf("[INFO] Pinch Zoom Start.\n");
+        gs->pinch_active = 1; gs->potential_two_finger_tap = 0; timer_cancel(TIMER_TWO_FINGER_TAP_EXPIRE);
+        send_uinput_event(uinput_fd, EV_KEY, KEY_LEFTCTRL, 1); *needs_sync = 1;
+    }
+    int hires = (int)round(settings->pinch_wheel_per_doubling * log2(dist / gs->pinch_start_dist)); // Spread = positive = zoom in
+    if (hires == gs->pinch_hires_sent) { return; }
+    send_uinput_event(uinput_fd, EV_REL, REL_WHEEL_HI_RES, hires - gs->pinch_hires_sent); gs->pinch_hires_sent = hires;
+    int notches = hires / 120; if (notches != gs->pinch_notches_sent) { send_uinput_event(uinput_fd, EV_REL, REL_WHEEL, notches - gs->pinch_notches_sent); gs->pinch_notches_sent = notches; }
+    *needs_sync = 1;
+}
+
+// --- Palm & Ghost Rejection ---
+// Contacts are classified per frame before the gesture engine sees them, from the slot's ABS_MT_TOOL_TYPE, ABS_MT_TOUCH_MAJOR,
+// ABS_MT_PRESSURE and position. Limits are set in millimetres/percent and scaled by the EVIOCGABS ranges of the grabbed device
+// (axes the driver doesn't report switch their rule off). A rejected contact's events are removed from the batch, so it never
+// counts as a finger. A contact that touches down as a palm, a near-weightless ghost or a fat touch at the edge is dropped
+// silently. A finger that later grows into a palm gets a synthetic TRACKING_ID_PALM_LIFT, which ends it without a tap.
+#define TRACKING_ID_PALM_LIFT -2
+#define PALM_FALLBACK_SPAN_MM 155.0 // Long side assumed when the driver reports no resolution (a 7" panel)
+typedef struct { int tracking_id; int x; int y; int major; int pressure; int tool; int changed; int fresh; int rejected; int late; } ContactState;
+ContactState contacts[MAX_SLOTS]; int contact_slot = 0;
+void palm_filter_reset() { int s; memset(contacts, 0, sizeof(contacts)); for (s = 0; s < MAX_SLOTS; ++s) { contacts[s].tracking_id = -1; } contact_slot = 0; }
+// Device units per millimetre along X (or Y); falls back to the panel size guess when the driver reports no resolution
+double palm_units_per_mm(const struct input_absinfo *abs) { if (abs->resolution > 0) { return abs->resolution; } int span = src_abs_x.maximum - src_abs_x.minimum; if (src_abs_y.maximum - src_abs_y.minimum > span) { span = src_abs_y.maximum - src_abs_y.minimum; } return span / PALM_FALLBACK_SPAN_MM; }
+ContactClass palm_classify(const ContactState *c) {
+    if (c->tool == MT_TOOL_PALM) { return CONTACT_PALM; }
+    double major_limit = 0.0; // Touch major shares the position's surface units unless the axis has its own resolution
+    if (settings->palm_major_mm > 0.0 && src_abs_major.maximum > src_abs_major.minimum) { major_limit = settings->palm_major_mm * (src_abs_major.resolution > 0 ? src_abs_major.resolution : palm_units_per_mm(&src_abs_x)); }
+    if (major_limit > 0.0 && c->major >= major_limit) { return CONTACT_PALM; }
+    if (!c->fresh) { return CONTACT_FINGER; } // Pressure and edge only judge the touch-down; a lifting finger gets light, a swipe may end at the edge
+    if (settings->ghost_pressure_pct > 0.0 && src_abs_pressure.maximum > src_abs_pressure.minimum && c->pressure < src_abs_pressure.minimum + settings->ghost_pressure_pct / 100.0 * (src_abs_pressure.maximum - src_abs_pressure.minimum)) { return CONTACT_GHOST; }
+    if (major_limit > 0.0 && settings->palm_edge_mm > 0.0 && c->major >= major_limit / 2) { // A resting thumb or hand edge: half a palm is enough there
+        double mx = settings->palm_edge_mm * palm_units_per_mm(&src_abs_x); double my = settings->palm_edge_mm * palm_units_per_mm(&src_abs_y);
+        if (c->x < src_abs_x.minimum + mx || c->x > src_abs_x.maximum - mx || c->y < src_abs_y.minimum + my || c->y > src_abs_y.maximum - my) { return CONTACT_EDGE; }
+    }
+    return CONTACT_FINGER;
+}
+int event_is_slot_event(const struct input_event *ev) { return ev->type == EV_ABS && ev->code >= ABS_MT_TOUCH_MAJOR && ev->code <= ABS_MT_TOOL_Y && ev->code != ABS_MT_SLOT; }
+// Filters the complete frame evs[begin, end) into evs[out, ...) and returns the new end of the output.
+int palm_filter_frame(struct input_event *evs, int begin, int end, int out) {
+    int k, s, slot = contact_slot;
+    for (k = begin; k < end; ++k) { // Pass 1: decode the frame into per-slot contact state
+        const struct input_event *e = &evs[k]; if (e->type != EV_ABS) { continue; }
+        if (e->code == ABS_MT_SLOT) { contact_slot = (e->value >= 0 && e->value < MAX_SLOTS) ? e->value : -1; continue; }
+        if (contact_slot < 0) { continue; }
+        ContactState *c = &contacts[contact_slot];
+        switch (e->code) {
+            case ABS_MT_TRACKING_ID: if (e->value == -1) { c->tracking_id = -1; } else if (c->tracking_id == -1) { c->tracking_id = e->value; c->fresh = 1; c->rejected = 0; c->late = 0; } break; // `rejected` outlives the lift so pass 2 drops it too
+            case ABS_MT_POSITION_X: c->x = e->value; break;
+            case ABS_MT_POSITION_Y: c->y = e->value; break;
+            case ABS_MT_TOUCH_MAJOR: c->major = e->value; break;
+            case ABS_MT_PRESSURE: c->pressure = e->value; break;
+            case ABS_MT_TOOL_TYPE: c->tool = e->value; break;
+        }
+        c->changed = 1;
+    }
+    for (s = 0; s < MAX_SLOTS; ++s) { // Classify the contacts this frame touched
+        ContactState *c = &contacts[s]; if (!c->changed) { continue; } c->changed = 0;
+        if (c->tracking_id != -1 && !c->rejected) { ContactClass cls = palm_classify(c); if (cls != CONTACT_FINGER) { c->rejected = 1; contacts_rejected[cls]++; if (!c->fresh) { c->late = 1; contacts_rejected_late++; } } }
+        c->fresh = 0;
+    }
+    for (k = begin; k < end; ++k) { // Pass 2: copy out everything but the rejected slots' events
+        const struct input_event *e = &evs[k];
+        if (e->type == EV_ABS && e->code == ABS_MT_SLOT) { slot = (e->value >= 0 && e->value < MAX_SLOTS) ? e->value : -1; }
+        else if (slot >= 0 && event_is_slot_event(e) && contacts[slot].rejected) {
+            if (!contacts[slot].late) { palm_dropped_events++; continue; }
+            contacts[slot].late = 0; evs[out] = *e; evs[out].code = ABS_MT_TRACKING_ID; evs[out].value = TRACKING_ID_PALM_LIFT; out++; continue; // First event of the frame becomes the lift
+        }
+        evs[out++] = *e;
+    }
+    return out;
+}
+// Filters the complete frames of a batch in place and returns their new count. A trailing partial frame is moved to
+// evs[returned count, + *held) to be completed by the next read; it is only judged on its own if it fills the whole batch.
+int palm_filter_batch(struct input_event *evs, int count, int *held) {
+    int k, begin = 0, out = 0;
+    for (k = 0; k < count; ++k) { if (evs[k].type == EV_SYN && evs[k].code == SYN_REPORT) { out = palm_filter_frame(evs, begin, k + 1, out); begin = k + 1; } }
+    if (begin == 0 && count == EVENT_BATCH_MAX) { *held = 0; return palm_filter_frame(evs, 0, count, 0); }
+    *held = count - begin; memmove(&evs[out], &evs[begin], (size_t)*held * sizeof(struct input_event)); return out;
+}
+
+// --- Gesture Engine ---
+// Press and sync now; the release is sent by TIMER_CLICK_RELEASE ~20 ms later instead of sleeping in the event loop.
+void emit_click(int uinput_fd, unsigned short button) {
+    if (timer_deadline_us[TIMER_CLICK_RELEASE]) { timer_cancel(TIMER_CLICK_RELEASE); send_uinput_event(uinput_fd, EV_KEY, click_release_button, 0); } // Back-to-back clicks
+    send_uinput_event(uinput_fd, EV_KEY, button, 1); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0);
+    click_release_button = button; timer_arm(TIMER_CLICK_RELEASE, engine_now_us + CLICK_HOLD_US);
+}
+void release_drag_button(int uinput_fd, int *needs_sync) { timer_cancel(TIMER_DRAG_LOCK); if (gesture_state.drag_active || gesture_state.drag_locked) { send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); *needs_sync = 1; } gesture_state.drag_active = 0; gesture_state.drag_locked = 0; }
+// With defer_tap_click, a finished tap waits for the double-tap window; anything other than a drag then sends it
+void flush_pending_tap(int uinput_fd, int *needs_sync) { if (gesture_state.pending_tap_click) { gesture_state.pending_tap_click = 0; printf("[INFO] Deferred Tap resolved. Sending Left Click.\n"); emit_click(uinput_fd, BTN_LEFT); *needs_sync = 1; } }
+void reset_gesture_state() { int i; memset(&gesture_state, 0, sizeof(GestureState)); for (i = 0; i < MAX_SLOTS; ++i) { gesture_state.slots[i].tracking_id = -1; } memset(timer_deadline_us, 0, sizeof(timer_deadline_us)); }
+void gesture_timer_fired(int uinput_fd, GestureTimer t, int *needs_sync) {
+    GestureState *gs = &gesture_state; int i;
+    switch (t) {
+        case TIMER_TAP_EXPIRE: gs->potential_single_tap = 0; break;
+        case TIMER_TWO_FINGER_TAP_EXPIRE: gs->potential_two_finger_tap = 0; break;
+        case TIMER_LONG_PRESS:
+            if (gs->active_finger_count != 1 || gs->is_moving || gs->drag_active) { break; }
+            for (i = 0; i < MAX_SLOTS; ++i) {
+                if (!gs->slots[i].active) { continue; }
+                long long dx = (long long)gs->slots[i].x - gs->slots[i].start_x; long long dy = (long long)gs->slots[i].y - gs->slots[i].start_y;
+                if (dx * dx + dy * dy <= settings->dead_zone_threshold_sq_tap_one) { printf("[INFO] Long Press detected! Sending Right Click.\n"); flush_pending_tap(uinput_fd, needs_sync); gs->long_press_clicks++; emit_click(uinput_fd, BTN_RIGHT); *needs_sync = 1; gs->long_press_fired = 1; gs->potential_single_tap = 0; gs->potential_drag_start = 0; }
+                break;
+            }
+            break;
+        case TIMER_DOUBLE_TAP_WINDOW: gs->double_tap_window_open = 0; flush_pending_tap(uinput_fd, needs_sync); break;
+        case TIMER_DRAG_LOCK: printf("[INFO] Drag lock expired. Releasing Left Button.\n"); release_drag_button(uinput_fd, needs_sync); break;
+        case TIMER_CLICK_RELEASE: send_uinput_event(uinput_fd, EV_KEY, click_release_button, 0); *needs_sync = 1; break;
+        default: break;
+    }
+}
+// Fires, in deadline order, every timer due at or before now_us, then syncs whatever they emitted
+void gesture_run_timers(int uinput_fd, long long now_us, int *needs_sync) {
+    int fired = 0; ProfilePhase phase = PROFILE_IDLE;
+    while (1) {
+        int t, due = -1; for (t = 0; t < TIMER_COUNT; ++t) { if (timer_deadline_us[t] && timer_deadline_us[t] <= now_us && (due < 0 || timer_deadline_us[t] < timer_deadline_us[due])) { due = t; } }
+        if (due < 0) { break; }
+        if (!fired) { phase = profile_switch(PROFILE_GESTURE); }
+        engine_now_us = timer_deadline_us[due]; timer_cancel((GestureTimer)due); gesture_timer_fired(uinput_fd, (GestureTimer)due, needs_sync); fired = 1;
+    }
+    if (*needs_sync) { if (send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { *needs_sync = 0; } }
+    if (fired) { struct timeval tv = { .tv_sec = engine_now_us / 1000000, .tv_usec = engine_now_us % 1000000 }; shm_state_publish(shm_state, &gesture_state, &tv); profile_switch(phase); }
+}
+// Runs one evdev event through the tap/drag/move logic. All timing comes from the kernel event timestamps, so recordings replay exactly.
+void gesture_event(int uinput_fd, const struct input_event *ev, int *needs_sync) {
     int i;
+    engine_now_us = timeval_us(&ev->time);
+    // --- Process Multi-Touch Event ---
+    int finger_lifted_slot = -1;
+    int previous_finger_count = gesture_state.active_finger_count; // Store count before processing event
+
+    // --- Optional: Log raw event for debugging ---
+    // printf("Event: time %ld.%06ld, type %u (%s), code %u (%s), value %d\n",
+    //        ev->time.tv_sec, (long)ev->time.tv_usec, ev->type, get_event_type_str(ev->type),
+    //        ev->code, get_code_str(ev->type, ev->code), ev->value);
+
+
+    switch (ev->type) {
+        case EV_ABS:
+            switch (ev->code) {
+                case ABS_MT_SLOT: if (ev->value >= 0 && ev->value < MAX_SLOTS) { gesture_state.current_slot = ev->value; } break;
+                case ABS_MT_TRACKING_ID:
+                    if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS) {
+                        int current_id = gesture_state.slots[gesture_state.current_slot].tracking_id; int new_id = ev->value;
+                        // printf("  [DEBUG] TRACKING_ID: Slot=%d, Value=%d (CurrentID=%d)\n", gesture_state.current_slot, new_id, current_id);
+                        if (current_id != -1 && (new_id == -1 || new_id == TRACKING_ID_PALM_LIFT)) { // Finger lifted (or turned out to be a palm: no tap then)
+                            if (gesture_state.slots[gesture_state.current_slot].active) {
+                                finger_lifted_slot = gesture_state.current_slot; // Record which slot lifted
+                                // printf("    [DEBUG] Finger Up: Slot=%d, ID=%d. Active Count was: %d\n", finger_lifted_slot, current_id, previous_finger_count);
+
+                                // ★★★ Perform Tap/Drag Release Checks HERE ★★★
+
+                                // --- Two-Finger Tap Check ---
+                                if (gesture_state.potential_two_finger_tap && previous_finger_count == 2) {
+                                     // printf("    [2F_TAP_DEBUG] Checking Tap for lifted slot %d\n", finger_lifted_slot);
+                                     struct timeval ct = ev->time; long dur = timeval_diff_ms(&gesture_state.two_finger_touch_time, &ct); int moved = 0;
+                                     long long dx_l = (long long)gesture_state.slots[finger_lifted_slot].x - (long long)gesture_state.slots[finger_lifted_slot].start_x; long long dy_l = (long long)gesture_state.slots[finger_lifted_slot].y - (long long)gesture_state.slots[finger_lifted_slot].start_y; if ((dx_l*dx_l + dy_l*dy_l) > settings->dead_zone_threshold_sq_tap_two) { moved = 1; /*printf("      [2F_TAP_DEBUG] Lifted slot moved: dist_sq=%lld\n", (dx_l*dx_l + dy_l*dy_l));*/ }
+                                     if (!moved) { for(i=0; i<MAX_SLOTS; ++i) { if(i != finger_lifted_slot && gesture_state.slots[i].active) { long long dx_o = (long long)gesture_state.slots[i].x - (long long)gesture_state.slots[i].start_x; long long dy_o = (long long)gesture_state.slots[i].y - (long long)gesture_state.slots[i].start_y; if ((dx_o*dx_o + dy_o*dy_o) > settings->dead_zone_threshold_sq_tap_two) { moved = 1; /*printf("      [2F_TAP_DEBUG] Other slot %d moved: dist_sq=%lld\n", i, (dx_o*dx_o + dy_o*dy_o));*/ break; } } } }
+                                     // printf("      [2F_TAP_DEBUG] Final Check: Duration=%ld ms (Timeout=%ld), Moved=%d\n", dur, settings->tap_timeout_ms_two, moved);
+                                     if (dur < settings->tap_timeout_ms_two && !moved && new_id != TRACKING_ID_PALM_LIFT) { printf("[INFO] Two-Finger Tap detected! Sending Right Click.\n"); emit_click(uinput_fd, BTN_RIGHT); *needs_sync = 1; }
+                                     gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0; timer_cancel(TIMER_TWO_FINGER_TAP_EXPIRE);
+                                     // printf("      [DEBUG] Reset 2F flags after check.\n");
+                                }
+
+                                // --- Single-Finger Tap/Drag Release Check ---
+                                if (previous_finger_count == 1) { // Check if the finger lifted was the *only* finger
+                                     // printf("    [1F_TAP_DEBUG] Checking Single Tap/Drag Release for lifted slot %d\n", finger_lifted_slot);
+                                     struct timeval current_time = ev->time; long duration_ms = timeval_diff_ms(&gesture_state.touch_down_time_single, &current_time);
+                                     long long dx_1f = (long long)gesture_state.slots[finger_lifted_slot].x - (long long)gesture_state.slots[finger_lifted_slot].start_x; long long dy_1f = (long long)gesture_state.slots[finger_lifted_slot].y - (long long)gesture_state.slots[finger_lifted_slot].start_y;
+                                     int moved_1f = (dx_1f * dx_1f + dy_1f * dy_1f) > settings->dead_zone_threshold_sq_tap_one; // Use TAP_ONE threshold
+                                     // printf("      [1F_TAP_DEBUG] Check: PotentialTap=%d, MovedCheck=%d (DistSq=%lld, Thresh=%d), DragActive=%d, Duration=%ld ms\n", gesture_state.potential_single_tap, moved_1f, (dx_1f*dx_1f + dy_1f*dy_1f), settings->dead_zone_threshold_sq_tap_one, gesture_state.drag_active, duration_ms);
+                                     timer_cancel(TIMER_TAP_EXPIRE); timer_cancel(TIMER_LONG_PRESS);
+                                     if (gesture_state.potential_single_tap && !moved_1f && new_id != TRACKING_ID_PALM_LIFT && !gesture_state.drag_active && duration_ms < settings->tap_timeout_ms_single) {
+                                         if (settings->defer_tap_click && !gesture_state.pending_tap_click) { gesture_state.pending_tap_click = 1; } // Decided when the double-tap window closes
+                                         else { flush_pending_tap(uinput_fd, needs_sync); printf("[INFO] Single Tap detected! Sending Left Click.\n"); emit_click(uinput_fd, BTN_LEFT); *needs_sync = 1; }
+                                     }
+                                     else if (gesture_state.drag_active && settings->drag_lock_ms > 0) { printf("[INFO] Drag paused (drag lock %ld ms).\n", settings->drag_lock_ms); gesture_state.drag_locked = 1; timer_arm(TIMER_DRAG_LOCK, engine_now_us + settings->drag_lock_ms * 1000); }
+                                     else if (gesture_state.drag_active) { printf("[INFO] Drag End (1F). Releasing Left Button.\n"); send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); *needs_sync = 1; }
+                                     else { flush_pending_tap(uinput_fd, needs_sync); }
+                                     // Reset flags after processing lift
+                                     gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.drag_active = 0; gesture_state.is_moving = 0; gesture_state.long_press_fired = 0;
+                                     gesture_state.last_touch_up_time = current_time; // Record time for double tap check
+                                     if (new_id != TRACKING_ID_PALM_LIFT) { gesture_state.double_tap_window_open = 1; timer_arm(TIMER_DOUBLE_TAP_WINDOW, engine_now_us + settings->double_tap_timeout_ms * 1000); }
+                                     // printf("      [DEBUG] Reset 1F flags. last_touch_up_time set.\n");
+                                }
+
+                                // Update state *after* all checks for the lifted finger
+                                gesture_state.slots[finger_lifted_slot].active = 0;
+                                gesture_state.slots[finger_lifted_slot].tracking_id = -1;
+                                gesture_state.active_finger_count--;
+                            }
+                        } else if (current_id == -1 && new_id >= 0) { // New finger down
+                            if(gesture_state.current_slot < MAX_SLOTS && !gesture_state.slots[gesture_state.current_slot].active) {
+                                gesture_state.slots[gesture_state.current_slot].active = 1; gesture_state.slots[gesture_state.current_slot].tracking_id = new_id; gesture_state.slots[gesture_state.current_slot].x = 0; gesture_state.slots[gesture_state.current_slot].y = 0; gesture_state.slots[gesture_state.current_slot].start_x = 0; gesture_state.slots[gesture_state.current_slot].start_y = 0; gesture_state.slots[gesture_state.current_slot].last_x = 0; gesture_state.slots[gesture_state.current_slot].last_y = 0; gesture_state.slots[gesture_state.current_slot].filt_t_us = 0; gesture_state.active_finger_count++;
+                                // printf("    [DEBUG] Finger Down: Slot=%d, ID=%d. Active Count: %d\n", gesture_state.current_slot, new_id, gesture_state.active_finger_count);
+                                struct timeval current_time = ev->time;
+                                if (gesture_state.active_finger_count == 1) {
+                                    /*printf("    [DEBUG] State: 1 Finger Down\n");*/ gesture_state.touch_down_time_single = current_time; gesture_state.potential_single_tap = 1; gesture_state.is_moving = 0; gesture_state.long_press_fired = 0;
+                                    if (gesture_state.drag_locked) { printf("[INFO] Drag resumed (drag lock).\n"); timer_cancel(TIMER_DRAG_LOCK); gesture_state.drag_locked = 0; gesture_state.drag_active = 1; gesture_state.drag_resumed = 1; gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; }
+                                    else { gesture_state.drag_active = 0; gesture_state.potential_drag_start = gesture_state.double_tap_window_open; /*Touched again inside the double-tap window*/ }
+                                    gesture_state.double_tap_window_open = 0; timer_cancel(TIMER_DOUBLE_TAP_WINDOW);
+                                    gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0;
+                                    if (gesture_state.potential_single_tap) { timer_arm(TIMER_TAP_EXPIRE, engine_now_us + settings->tap_timeout_ms_single * 1000); if (settings->long_press_ms > 0) { timer_arm(TIMER_LONG_PRESS, engine_now_us + settings->long_press_ms * 1000); } }
+                                }
+                                else if (gesture_state.active_finger_count == 2) { /*printf("    [DEBUG] State: 2 Fingers Down\n");*/ flush_pending_tap(uinput_fd, needs_sync); release_drag_button(uinput_fd, needs_sync); timer_cancel(TIMER_TAP_EXPIRE); timer_cancel(TIMER_LONG_PRESS); gesture_state.potential_two_finger_tap = 1; gesture_state.two_finger_touch_time = ev->time; timer_arm(TIMER_TWO_FINGER_TAP_EXPIRE, engine_now_us + settings->tap_timeout_ms_two * 1000); gesture_state.two_finger_start_coords_set = 0; gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.is_moving = 0; }
+                                else { /*printf("    [DEBUG] State: %d Fingers Down - Resetting gestures\n", gesture_state.active_finger_count);*/ release_drag_button(uinput_fd, needs_sync); timer_cancel(TIMER_TWO_FINGER_TAP_EXPIRE); gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.potential_two_finger_tap = 0; gesture_state.is_moving = 0; }
+                            }
+                        }
+                    } break; // End ABS_MT_TRACKING_ID
+                case ABS_MT_POSITION_X: if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS && gesture_state.slots[gesture_state.current_slot].active) { gesture_state.slots[gesture_state.current_slot].raw_x = ev->value; } break;
+                case ABS_MT_POSITION_Y: if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS && gesture_state.slots[gesture_state.current_slot].active) { gesture_state.slots[gesture_state.current_slot].raw_y = ev->value; } break;
+            } break; // End EV_ABS
+
+        case EV_SYN:
+            if (ev->code == SYN_REPORT) {
+                // printf("  [DEBUG] SYN_REPORT - Active Fingers: %d\n", gesture_state.active_finger_count);
+                int current_active_finger_count = gesture_state.active_finger_count;
+                gesture_state.last_dx_rel = 0; gesture_state.last_dy_rel = 0;
+                for (i = 0; i < MAX_SLOTS; ++i) { if (gesture_state.slots[i].active) { jitter_filter_slot(&gesture_state.slots[i], engine_now_us); } }
+
+                // Set Start Coords
+                if (gesture_state.potential_two_finger_tap && current_active_finger_count == 2 && !gesture_state.two_finger_start_coords_set) { /*printf("    [DEBUG] Recording 2F start coords on SYN report:\n");*/ for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { gesture_state.slots[i].start_x = gesture_state.slots[i].x; gesture_state.slots[i].start_y = gesture_state.slots[i].y; /*printf("      Slot %d Start: X=%d, Y=%d\n", i, gesture_state.slots[i].start_x, gesture_state.slots[i].start_y);*/ } } gesture_state.two_finger_start_coords_set = 1; }
+                if (current_active_finger_count == 1) { int active_slot = -1; for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { active_slot = i; break; } } if (active_slot != -1 && gesture_state.slots[active_slot].last_x == 0 && gesture_state.slots[active_slot].last_y == 0 && ((!gesture_state.is_moving && !gesture_state.drag_active) || gesture_state.drag_resumed)) { gesture_state.drag_resumed = 0; gesture_state.slots[active_slot].start_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].start_y = gesture_state.slots[active_slot].y; gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y; /*printf("    [DEBUG] Recording 1F start/last coords: Slot=%d, X=%d, Y=%d\n", active_slot, gesture_state.slots[active_slot].start_x, gesture_state.slots[active_slot].start_y);*/ } }
+
+                // --- Tap/Drag Release Checks Moved to TRACKING_ID ---
+
+                // --- Two-Finger Pinch Logic ---
+                if (current_active_finger_count == 2) { pinch_frame(uinput_fd, needs_sync); } else if (gesture_state.pinch_tracking) { pinch_end(uinput_fd, needs_sync); }
+
+                // --- Single-Finger Movement Logic ---
+                if (current_active_finger_count == 1) {
+                    int active_slot = -1; for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { active_slot = i; break; } }
+                    if (active_slot != -1) {
+                        long long dist_x = (long long)gesture_state.slots[active_slot].x - (long long)gesture_state.slots[active_slot].start_x; long long dist_y = (long long)gesture_state.slots[active_slot].y - (long long)gesture_state.slots[active_slot].start_y; long long dist_sq = dist_x * dist_x + dist_y * dist_y;
+                        int threshold_to_use = gesture_state.potential_drag_start ? settings->dead_zone_threshold_sq_drag_start : settings->dead_zone_threshold_sq_move;
+                        if (!gesture_state.is_moving && !gesture_state.drag_active && dist_sq > threshold_to_use) {
+                            // printf("    [MOVE_DEBUG] Dead zone exceeded (Slot %d): dist_sq=%lld, threshold=%d\n", active_slot, dist_sq, threshold_to_use);
+                            gesture_state.is_moving = 1; timer_cancel(TIMER_LONG_PRESS);
+                            // Tap potential is checked on lift, not cancelled here
+                            if (gesture_state.potential_drag_start) { printf("[INFO] Drag Start (1F DoubleTap+Hold+Swipe)\n"); gesture_state.pending_tap_click = 0; /*The deferred tap was the first half of this drag*/ send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 1); *needs_sync = 1; gesture_state.drag_active = 1; gesture_state.potential_drag_start = 0; gesture_state.potential_single_tap = 0; }
+                            gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y;
+                        }
+                        if (output_mode == OUTPUT_MODE_ABSOLUTE) { absolute_emit(uinput_fd, &gesture_state.slots[active_slot], needs_sync); } // Every frame, from touch-down: taps click where the finger is
+                        else if (gesture_state.is_moving || gesture_state.drag_active) {
+                            int delta_abs_x = gesture_state.slots[active_slot].x - gesture_state.slots[active_slot].last_x; int delta_abs_y = gesture_state.slots[active_slot].y - gesture_state.slots[active_slot].last_y; int dx_rel = 0; int dy_rel = 0;
+                            if (delta_abs_x != 0 || delta_abs_y != 0) {
+                                 dx_rel = (int)round((double)(delta_abs_y) * settings->sensitivity); dy_rel = (int)round((double)(-delta_abs_x) * settings->sensitivity);
+                                 // printf("    [MOVE_DEBUG] Slot %d Delta: dX_abs=%d, dY_abs=%d -> dX_rel=%d, dY_rel=%d\n", active_slot, delta_abs_x, delta_abs_y, dx_rel, dy_rel);
+                                 if (dx_rel != 0) { send_uinput_event(uinput_fd, EV_REL, REL_X, dx_rel); *needs_sync = 1; }
+                                 if (dy_rel != 0) { send_uinput_event(uinput_fd, EV_REL, REL_Y, dy_rel); *needs_sync = 1; }
+                                 gesture_state.last_dx_rel = dx_rel; gesture_state.last_dy_rel = dy_rel;
+                                 gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y;
+                            }
+                        }
+                    }
+                }
+
+                // Send sync to uinput if needed
+                if (*needs_sync) { if(send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { *needs_sync = 0; } }
+                // Reset potential flags based on current count
+                if(current_active_finger_count != 2 && gesture_state.potential_two_finger_tap) { gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0; }
+                if(current_active_finger_count != 1 && gesture_state.potential_single_tap) { gesture_state.potential_single_tap = 0;}
+                shm_state_publish(shm_state, &gesture_state, &ev->time);
+
+            } // end if SYN_REPORT
+            break; // End EV_SYN
+    } // End switch(ev->type)
+}
+
+// --- Backlog Coalescing ---
+// After a stall one read returns several complete frames. Rather than reporting each stale frame, a SYN_REPORT is folded into
+// the next frame when both frames carry only position-type events (no finger added or lifted, no key) and the engine is in a
+// pure-motion state (one finger already moving or dragging, or a latched pinch). The folded frame's positions are simply
+// overwritten, and since the engine emits position differences the next SYN_REPORT sends the summed delta. The last frame of
+// a batch is always reported, so after a stall the output is at most one frame behind the finger.
+int event_is_motion(const struct input_event *ev) { return (ev->type == EV_ABS && ev->code != ABS_MT_TRACKING_ID) || ev->type == EV_MSC; }
+int gesture_state_is_pure_motion() { const GestureState *gs = &gesture_state; return (gs->active_finger_count == 1 && (gs->is_moving || gs->drag_active) && !gs->drag_resumed) || (gs->active_finger_count == 2 && gs->pinch_active); }
+// Sets merge[k] for every SYN_REPORT that may be folded into the following frame. *open_pure carries the purity of a frame
+// split across two reads. Returns the number of complete frames in the batch.
+int coalesce_mark_frames(const struct input_event *evs, int count, unsigned char *merge, int *open_pure) {
+    int k, frames = 0, prev_syn = -1, prev_pure = 0, pure = *open_pure;
+    for (k = 0; k < count; ++k) {
+        merge[k] = 0;
+        if (evs[k].type == EV_SYN && evs[k].code == SYN_REPORT) { if (prev_syn >= 0 && prev_pure && pure) { merge[prev_syn] = 1; } prev_syn = k; prev_pure = pure; pure = 1; frames++; }
+        else if (!event_is_motion(&evs[k])) { pure = 0; }
+    }
+    *open_pure = pure; return frames;
+}
+unsigned long long coalesced_frames = 0; unsigned long long backlog_batches = 0;
+
+// --- Settings File (--config) ---
+// "key = value" lines ('#' starts a comment) applied over DEFAULT_SETTINGS; dead zones are radii in device units. A file is
+// parsed and validated as a whole into a fresh Settings object that is never modified once published. A watcher thread
+// re-reads it on every inotify change and leaves a valid result in pending_settings; the event loop takes it with one
+// pointer exchange right after a SYN_REPORT, so a frame never sees a half-applied file and the hot path only reads `settings`.
+typedef enum { SETTING_DOUBLE, SETTING_LONG, SETTING_INT, SETTING_RADIUS } SettingKind; // RADIUS: stored squared in an int
+typedef struct { const char *key; SettingKind kind; size_t offset; double min; double max; } SettingKey;
+const SettingKey SETTING_KEYS[] = {
+    { "sensitivity",              SETTING_DOUBLE, offsetof(Settings, sensitivity), 0.05, 20.0 },
+    { "dead_zone_move",           SETTING_RADIUS, offsetof(Settings, dead_zone_threshold_sq_move), 0, 1000 },
+    { "dead_zone_drag_start",     SETTING_RADIUS, offsetof(Settings, dead_zone_threshold_sq_drag_start), 0, 1000 },
+    { "dead_zone_tap_one",        SETTING_RADIUS, offsetof(Settings, dead_zone_threshold_sq_tap_one), 0, 1000 },
+    { "dead_zone_tap_two",        SETTING_RADIUS, offsetof(Settings, dead_zone_threshold_sq_tap_two), 0, 1000 },
+    { "dead_zone_pinch",          SETTING_RADIUS, offsetof(Settings, dead_zone_threshold_sq_pinch), 0, 1000 },
+    { "tap_timeout_ms_single",    SETTING_LONG,   offsetof(Settings, tap_timeout_ms_single), 1, 5000 },
+    { "double_tap_timeout_ms",    SETTING_LONG,   offsetof(Settings, double_tap_timeout_ms), 1, 5000 },
+    { "tap_timeout_ms_two",       SETTING_LONG,   offsetof(Settings, tap_timeout_ms_two), 1, 5000 },
+    { "long_press_ms",            SETTING_LONG,   offsetof(Settings, long_press_ms), 0, 10000 },
+    { "drag_lock_ms",             SETTING_LONG,   offsetof(Settings, drag_lock_ms), 0, 10000 },
+    { "defer_tap_click",          SETTING_INT,    offsetof(Settings, defer_tap_click), 0, 1 },
+    { "filter_min_cutoff_hz",     SETTING_DOUBLE, offsetof(Settings, filter_min_cutoff_hz), 0, 100 },
+    { "filter_beta",              SETTING_DOUBLE, offsetof(Settings, filter_beta), 0, 10 },
+    { "filter_d_cutoff_hz",       SETTING_DOUBLE, offsetof(Settings, filter_d_cutoff_hz), 0.01, 100 },
+    { "pinch_wheel_per_doubling", SETTING_DOUBLE, offsetof(Settings, pinch_wheel_per_doubling), 1, 10000 },
+    { "palm_major_mm",            SETTING_DOUBLE, offsetof(Settings, palm_major_mm), 0, 200 },
+    { "palm_edge_mm",             SETTING_DOUBLE, offsetof(Settings, palm_edge_mm), 0, 50 },
+    { "ghost_pressure_pct",       SETTING_DOUBLE, offsetof(Settings, ghost_pressure_pct), 0, 100 },
+};
+#define SETTING_KEY_COUNT (sizeof(SETTING_KEYS) / sizeof(SETTING_KEYS[0]))
+const char *config_path = NULL; char config_device_name[256];
+Settings *pending_settings = NULL; // Handed from the watcher thread to the event loop; each side takes it with __atomic_exchange_n
+pthread_t config_thread; int config_thread_running = 0; int config_inotify_fd = -1; int config_stop_fd = -1; // eventfd: tells the watcher to exit
+
+// Fills *out from DEFAULT_SETTINGS plus the file. Returns -1 (and reports every bad line) if anything is invalid.
+int load_settings_file(const char *path, Settings *out, char *device_name, size_t device_name_size) {
+    FILE *fp = fopen(path, "r"); if (fp == NULL) { fprintf(stderr, "[ERROR] Cannot open config \"%s\": %s\n", path, strerror(errno)); return -1; }
+    char line[512]; int line_no = 0; int errors = 0; size_t k;
+    *out = DEFAULT_SETTINGS;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++; char *hash = strchr(line, '#'); if (hash) { *hash = '\0'; }
+        char *key = line + strspn(line, " \t\r\n"); if (*key == '\0') { continue; }
+        char *eq = strchr(key, '='); if (eq == NULL) { fprintf(stderr, "[ERROR] %s:%d: expected \"key = value\"\n", path, line_no); errors++; continue; }
+        char *key_end = eq; while (key_end > key && isspace((unsigned char)key_end[-1])) { key_end--; } *key_end = '\0';
+        char *value = eq + 1 + strspn(eq + 1, " \t"); char *value_end = value + strlen(value); while (value_end > value && isspace((unsigned char)value_end[-1])) { value_end--; } *value_end = '\0';
+        if (strcmp(key, "device_name") == 0) { if (value_end - value >= 2 && value[0] == '"' && value_end[-1] == '"') { value++; value_end[-1] = '\0'; } if (device_name) { snprintf(device_name, device_name_size, "%s", value); } continue; }
+        for (k = 0; k < SETTING_KEY_COUNT && strcmp(key, SETTING_KEYS[k].key) != 0; ++k) {}
+        if (k == SETTING_KEY_COUNT) { fprintf(stderr, "[ERROR] %s:%d: unknown key \"%s\"\n", path, line_no, key); errors++; continue; }
+        const SettingKey *sk = &SETTING_KEYS[k]; char *end; double v = strtod(value, &end);
+        if (end == value || *end != '\0' || !(isfinite(v) && v >= sk->min && v <= sk->max) || ((sk->kind == SETTING_LONG || sk->kind == SETTING_INT) && v != floor(v))) { fprintf(stderr, "[ERROR] %s:%d: %s must be a%s number in %g..%g (got \"%s\")\n", path, line_no, sk->key, sk->kind == SETTING_LONG || sk->kind == SETTING_INT ? "n integer" : "", sk->min, sk->max, value); errors++; continue; }
+        char *field = (char *)out + sk->offset;
+        switch (sk->kind) {
+            case SETTING_DOUBLE: *(double *)field = v; break;
+            case SETTING_LONG: *(long *)field = (long)v; break;
+            case SETTING_INT: *(int *)field = (int)v; break;
+            case SETTING_RADIUS: *(int *)field = (int)(v * v); break;
+        }
+    }
+    fclose(fp);
+    if (errors) { fprintf(stderr, "[ERROR] %s: %d error(s); settings not applied.\n", path, errors); return -1; }
+    return 0;
+}
+// Watcher thread: the directory is watched, not the file, so editors that save by rename are seen too. It only exits between
+// reloads, when config_stop_fd becomes readable, so a reload in progress never leaks its FILE or Settings.
+void* config_watch_thread(void *arg) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event)))); const char *name = arg; char *p;
+    while (1) {
+        struct pollfd pfds[2] = { { .fd = config_inotify_fd, .events = POLLIN, .revents = 0 }, { .fd = config_stop_fd, .events = POLLIN, .revents = 0 } };
+        if (poll(pfds, 2, -1) == -1) { if (errno == EINTR) { continue; } break; }
+        if (pfds[1].revents) { break; }
+        ssize_t n = read(config_inotify_fd, buf, sizeof(buf)); if (n <= 0) { if (n == -1 && errno == EINTR) { continue; } break; }
+        int changed = 0; for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) { const struct inotify_event *ie = (const struct inotify_event *)p; if (ie->len && strcmp(ie->name, name) == 0) { changed = 1; } }
+        if (!changed) { continue; }
+        Settings *next = malloc(sizeof(Settings)); char device_name[sizeof(config_device_name)] = "";
+        if (next == NULL || load_settings_file(config_path, next, device_name, sizeof(device_name)) == -1) { free(next); continue; } // Keep running on the current settings
+        if (device_name[0] && strcmp(device_name, config_device_name) != 0) { fprintf(stderr, "[WARN] device_name change takes effect on restart.\n"); }
+        printf("[INFO] Reloaded %s; applying at the next frame.\n", config_path); fflush(stdout);
+        free(__atomic_exchange_n(&pending_settings, next, __ATOMIC_ACQ_REL)); // Drops a reload the event loop has not taken yet
+    }
+    return NULL;
+}
+void config_watch_stop();
+int config_watch_start() {
+    char dir[512]; const char *slash = strrchr(config_path, '/'); snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - config_path) + 1 : 1, slash ? config_path : ".");
+    config_inotify_fd = inotify_init1(IN_CLOEXEC); config_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (config_inotify_fd == -1 || config_stop_fd == -1 || inotify_add_watch(config_inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) { fprintf(stderr, "[WARN] Cannot watch %s for changes (%s); live reload disabled.\n", dir, strerror(errno)); config_watch_stop(); return -1; }
+    sigset_t all, old; sigfillset(&all); pthread_sigmask(SIG_BLOCK, &all, &old); // Signals must reach the event loop, not the watcher
+    int err = pthread_create(&config_thread, NULL, config_watch_thread, (void *)(slash ? slash + 1 : config_path));
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) { fprintf(stderr, "[WARN] Cannot start config watcher: %s; live reload disabled.\n", strerror(err)); config_watch_stop(); return -1; }
+    config_thread_running = 1; printf("[INFO] Watching %s for changes.\n", config_path); return 0;
+}
+void config_watch_stop() {
+    uint64_t one = 1;
+    if (config_thread_running) { if (write(config_stop_fd, &one, sizeof(one)) == -1) { perror("[WARN] Cannot signal the config watcher"); } pthread_join(config_thread, NULL); config_thread_running = 0; }
+    if (config_inotify_fd >= 0) { close(config_inotify_fd); config_inotify_fd = -1; }
+    if (config_stop_fd >= 0) { close(config_stop_fd); config_stop_fd = -1; }
+    free(__atomic_exchange_n(&pending_settings, NULL, __ATOMIC_ACQUIRE));
+}
+// Event loop only, at a frame boundary: publish the pending snapshot and free the one it replaces (nothing else points into it).
+void settings_apply_pending() {
+    Settings *next = __atomic_exchange_n(&pending_settings, NULL, __ATOMIC_ACQUIRE); if (next == NULL) { return; }
+    if (output_mode == OUTPUT_MODE_PASSTHROUGH && next->sensitivity != settings->sensitivity) { fprintf(stderr, "[WARN] In passthrough mode sensitivity sizes the virtual touchpad; the change takes effect on restart.\n"); next->sensitivity = settings->sensitivity; }
+    const Settings *old = settings; settings = next; if (old != &DEFAULT_SETTINGS) { free((void *)old); }
+    printf("[INFO] New settings in effect.\n");
+}
+
+// --- Recording & Offline Threshold Tuning (--record, --tune) ---
+// --record FILE appends every raw evdev event read to FILE (plain struct input_event records).
+// --tune MANIFEST replays a labelled corpus of such recordings through gesture_event() for every point of a threshold grid,
+// in parallel across cores, and reports the misclassification rate and time-to-decision of each setting.
+// Manifest lines are "<label> <recording>" with labels none|move|tap|double-tap|drag|two-finger-tap|long-press|pinch; relative paths
+// are resolved against the manifest's directory and '#' starts a comment.
+typedef enum { GESTURE_NONE, GESTURE_MOVE, GESTURE_TAP, GESTURE_DOUBLE_TAP, GESTURE_DRAG, GESTURE_TWO_FINGER_TAP, GESTURE_LONG_PRESS, GESTURE_PINCH, GESTURE_LABEL_COUNT } GestureLabel;
+const char *GESTURE_LABEL_NAMES[GESTURE_LABEL_COUNT] = { "none", "move", "tap", "double-tap", "drag", "two-finger-tap", "long-press", "pinch" };
+typedef struct { GestureLabel label; struct input_event *events; int count; } Recording;
+// What the gesture engine emitted during one replay, with the (event-time) moment each kind of output first appeared
+typedef struct { int left_presses; int right_presses; int long_presses; int rel_events; int wheel_events; int left_down; int dragged; long long left_press_us[2]; long long last_left_press_us; long long right_us; long long long_press_us; long long move_us; long long drag_us; long long wheel_us; } ReplayOutcome;
+ReplayOutcome replay_outcome; int record_fd = -1;
+
+struct input_event* load_recording_file(const char *path, int *out_count) {
+    FILE *rf = fopen(path, "rb"); if (rf == NULL) { fprintf(stderr, "[ERROR] Cannot open recording \"%s\": %s\n", path, strerror(errno)); return NULL; }
+    fseek(rf, 0, SEEK_END); long size = ftell(rf); fseek(rf, 0, SEEK_SET);
+    int n = (int)(size / (long)sizeof(struct input_event)); struct input_event *evs = malloc((size_t)n * sizeof(struct input_event) + 1);
+    if (evs == NULL || fread(evs, sizeof(struct input_event), (size_t)n, rf) != (size_t)n) { fprintf(stderr, "[ERROR] Cannot read recording \"%s\"\n", path); free(evs); fclose(rf); return NULL; }
+    fclose(rf); *out_count = n; return evs;
+}
+
+// Output sink used while replaying: classifies instead of writing to uinput
+int classify_init(int in_fd, int out_fd) { (void)in_fd; (void)out_fd; return 0; }
+int classify_read_events(struct input_event *buf, int max, long long timeout_us) { (void)buf; (void)max; (void)timeout_us; return 0; }
+int classify_write_frame(const struct input_event *evs, int count) {
+    ReplayOutcome *o = &replay_outcome; int i;
+    for (i = 0; i < count; ++i) {
+        if (evs[i].type == EV_KEY && evs[i].code == BTN_LEFT) { if (evs[i].value) { if (o->left_presses < 2) { o->left_press_us[o->left_presses] = engine_now_us; } o->left_presses++; o->last_left_press_us = engine_now_us; } o->left_down = evs[i].value; }
+        else if (evs[i].type == EV_KEY && evs[i].code == BTN_RIGHT && evs[i].value) {
+            if (gesture_state.long_press_clicks > o->long_presses) { if (o->long_presses++ == 0) { o->long_press_us = engine_now_us; } } // Came from TIMER_LONG_PRESS
+            else if (o->right_presses++ == 0) { o->right_us = engine_now_us; }
+        }
+        else if (evs[i].type == EV_REL && evs[i].code == REL_WHEEL_HI_RES) { if (o->wheel_events++ == 0) { o->wheel_us = engine_now_us; } }
+        else if (evs[i].type == EV_REL && (evs[i].code == REL_X || evs[i].code == REL_Y)) { if (o->rel_events++ == 0) { o->move_us = engine_now_us; } if (o->left_down && !o->dragged) { o->dragged = 1; o->drag_us = o->last_left_press_us; } }
+    }
+    return 0;
+}
+void classify_flush(void) {}
+void classify_destroy(void) {}
+const IoBackend io_backend_classify = { "classify", classify_init, classify_read_events, classify_write_frame, classify_flush, classify_destroy };
+
+// --replay FILE: feeds a recording through the live event loop instead of the touchscreen, one device frame per read and as
+// fast as the loop takes it, with output written to the real uinput device. With --profile this gives repeatable numbers.
+const char *replay_path = NULL; struct input_event *replay_events = NULL; int replay_count = 0; int replay_pos = 0;
+int replay_init(int in_fd, int out_fd) { (void)in_fd; replay_events = load_recording_file(replay_path, &replay_count); replay_pos = 0; if (replay_events == NULL) { return -1; } printf("[INFO] Replaying %d events from %s\n", replay_count, replay_path); return rw_init(-1, out_fd); }
+int replay_read_events(struct input_event *buf, int max, long long timeout_us) {
+    int count = 0; (void)timeout_us; struct timespec zero = { 0, 0 };
+    if (io_wait_sigmask != NULL && ppoll(NULL, 0, &zero, io_wait_sigmask) == -1) { return -1; } // Never waits, so let blocked stop/dump signals in here (EINTR)
+    if (replay_pos >= replay_count) { errno = ENODATA; return -1; }
+    while (replay_pos < replay_count && count < max) { const struct input_event *ev = &replay_events[replay_pos++]; buf[count++] = *ev; if (ev->type == EV_SYN && ev->code == SYN_REPORT) { break; } }
+    io_stats.reads++; return count;
+}
+void replay_destroy(void) { free(replay_events); replay_events = NULL; rw_destroy(); }
+const IoBackend io_backend_replay = { "replay", replay_init, replay_read_events, rw_write_frame, rw_flush, replay_destroy };
+
+// Replays one recording from a clean state; returns the recognised gesture and the time from first touch to the deciding output.
+GestureLabel replay_recording(const Recording *rec, long long *decision_us) {
+    int needs_sync = 0; int i; long long first_touch_us = -1;
+    reset_gesture_state(); memset(&replay_outcome, 0, sizeof(replay_outcome));
+    for (i = 0; i < rec->count; ++i) {
+        const struct input_event *ev = &rec->events[i];
+        gesture_run_timers(-1, timeval_us(&ev->time), &needs_sync); // Deadlines that fell between two recorded events
+        if (first_touch_us < 0 && ev->type == EV_ABS && ev->code == ABS_MT_TRACKING_ID && ev->value != -1) { first_touch_us = engine_now_us; }
+        gesture_event(-1, ev, &needs_sync);
+    }
+    gesture_run_timers(-1, LLONG_MAX, &needs_sync); // Let pending deadlines (deferred taps, click releases) play out
+    const ReplayOutcome *o = &replay_outcome; GestureLabel label; long long at;
+    if (o->wheel_events > 0) { label = GESTURE_PINCH; at = o->wheel_us; }
+    else if (o->long_presses > 0) { label = GESTURE_LONG_PRESS; at = o->long_press_us; }
+    else if (o->right_presses > 0) { label = GESTURE_TWO_FINGER_TAP; at = o->right_us; }
+    else if (o->dragged) { label = GESTURE_DRAG; at = o->drag_us; }
+    else if (o->left_presses >= 2) { label = GESTURE_DOUBLE_TAP; at = o->left_press_us[1]; }
+    else if (o->left_presses == 1) { label = GESTURE_TAP; at = o->left_press_us[0]; }
+    else if (o->rel_events > 0) { label = GESTURE_MOVE; at = o->move_us; }
+    else { label = GESTURE_NONE; at = first_touch_us; }
+    *decision_us = (first_touch_us >= 0) ? at - first_touch_us : 0;
+    return label;
+}
+
+// Grid axes. Dead zones are given as radii in device units and squared when applied.
+enum { TUNE_MOVE, TUNE_DRAG_START, TUNE_TAP_ONE, TUNE_TAP_TWO, TUNE_TAP_MS, TUNE_TAP_TWO_MS, TUNE_DOUBLE_TAP_MS, TUNE_PINCH, TUNE_LONG_PRESS_MS, TUNE_AXIS_COUNT };
+#define TUNE_MAX_VALUES 16
+typedef struct { const char *key; int values[TUNE_MAX_VALUES]; int count; } TuneAxis;
+TuneAxis tune_axes[TUNE_AXIS_COUNT] = {
+    { "move",          { 4, 6, 8, 10, 12, 15 }, 6 },
+    { "drag_start",    { 15, 20, 25, 30, 40 }, 5 },
+    { "tap_one",       { 10, 15, 20, 25, 30 }, 5 },
+    { "tap_two",       { 10, 15, 20, 30, 40 }, 5 },
+    { "tap_ms",        { 120, 150, 180, 220, 260 }, 5 },
+    { "tap_two_ms",    { 150, 200, 250, 300 }, 4 },
+    { "double_tap_ms", { 100, 150, 200, 300 }, 4 },
+    { "pinch",         { 40 }, 1 }, // Single value by default; widen with --grid pinch=...
+    { "long_press_ms", { 700 }, 1 }, // Likewise; 0 switches long press off
+};
+void apply_tune_value(Settings *s, int axis, int v) {
+    switch (axis) {
+        case TUNE_MOVE: s->dead_zone_threshold_sq_move = v * v; break;
+        case TUNE_DRAG_START: s->dead_zone_threshold_sq_drag_start = v * v; break;
+        case TUNE_TAP_ONE: s->dead_zone_threshold_sq_tap_one = v * v; break;
+        case TUNE_TAP_TWO: s->dead_zone_threshold_sq_tap_two = v * v; break;
+        case TUNE_TAP_MS: s->tap_timeout_ms_single = v; break;
+        case TUNE_TAP_TWO_MS: s->tap_timeout_ms_two = v; break;
+        case TUNE_DOUBLE_TAP_MS: s->double_tap_timeout_ms = v; break;
+        case TUNE_PINCH: s->dead_zone_threshold_sq_pinch = v * v; break;
+        case TUNE_LONG_PRESS_MS: s->long_press_ms = v; break;
+    }
+}
+// Decodes a flat grid index (mixed radix over the axes) into a full settings object
+void tune_settings_for_index(const Settings *base, long index, Settings *out) { int axis; *out = *base; for (axis = 0; axis < TUNE_AXIS_COUNT; ++axis) { apply_tune_value(out, axis, tune_axes[axis].values[index % tune_axes[axis].count]); index /= tune_axes[axis].count; } }
+void print_tune_settings(long index) { int axis; for (axis = 0; axis < TUNE_AXIS_COUNT; ++axis) { printf(" %s=%d", tune_axes[axis].key, tune_axes[axis].values[index % tune_axes[axis].count]); index /= tune_axes[axis].count; } }
+// "--grid key=v1,v2,..." replaces one axis
+int parse_tune_grid(const char *spec) {
+    int axis; const char *eq = strchr(spec, '='); if (eq == NULL) { return -1; }
+    for (axis = 0; axis < TUNE_AXIS_COUNT; ++axis) {
+        if (strlen(tune_axes[axis].key) != (size_t)(eq - spec) || strncmp(spec, tune_axes[axis].key, eq - spec) != 0) { continue; }
+        int count = 0; const char *p = eq + 1; char *end;
+        while (*p && count < TUNE_MAX_VALUES) { long v = strtol(p, &end, 10); if (end == p || v < 0) { return -1; } tune_axes[axis].values[count++] = (int)v; p = (*end == ',') ? end + 1 : end; if (*end != ',' && *end != '\0') { return -1; } }
+        if (count == 0) { return -1; } tune_axes[axis].count = count; return 0;
+    }
+    return -1;
+}
+Recording* load_tune_corpus(const char *manifest_path, int *out_count) {
+    FILE *fp = fopen(manifest_path, "r"); if (fp == NULL) { fprintf(stderr, "[ERROR] Cannot open manifest \"%s\": %s\n", manifest_path, strerror(errno)); return NULL; }
+    char dir[512]; const char *slash = strrchr(manifest_path, '/'); snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - manifest_path) : 1, slash ? manifest_path : ".");
+    Recording *recs = NULL; int count = 0, capacity = 0; char line[1024]; int line_no = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char label_str[64], rel_path[768], path[1300]; int label; line_no++;
+        char *hash = strchr(line, '#'); if (hash) { *hash = '\0'; }
+        if (sscanf(line, "%63s %767s", label_str, rel_path) != 2) { continue; }
+        for (label = 0; label < GESTURE_LABEL_COUNT && strcmp(label_str, GESTURE_LABEL_NAMES[label]) != 0; ++label) {}
+        if (label == GESTURE_LABEL_COUNT) { fprintf(stderr, "[WARN] %s:%d: unknown label \"%s\", skipping.\n", manifest_path, line_no, label_str); continue; }
+        if (rel_path[0] == '/') { snprintf(path, sizeof(path), "%s", rel_path); } else { snprintf(path, sizeof(path), "%s/%s", dir, rel_path); }
+        int n; struct input_event *evs = load_recording_file(path, &n); if (evs == NULL) { fprintf(stderr, "[WARN] %s:%d: skipping \"%s\"\n", manifest_path, line_no, path); continue; }
+        if (count == capacity) { capacity = capacity ? capacity * 2 : 64; Recording *grown = realloc(recs, (size_t)capacity * sizeof(Recording)); if (grown == NULL) { perror("[ERROR] Out of memory"); free(evs); break; } recs = grown; }
+        recs[count].label = (GestureLabel)label; recs[count].events = evs; recs[count].count = n; count++;
+    }
+    fclose(fp); *out_count = count; return recs;
+}
+typedef struct { int misfires; int decided; long long decision_us_sum; } TuneResult;
+typedef struct { long index; double misfire_rate; double mean_decision_ms; int decided; } TuneRanked;
+// Fastest mean decision first; points that recognised no gesture at all have no decision time and go last
+int compare_tune_ranked(const void *a, const void *b) { const TuneRanked *x = a, *y = b; if ((x->decided > 0) != (y->decided > 0)) { return x->decided > 0 ? -1 : 1; } if (x->mean_decision_ms != y->mean_decision_ms) { return x->mean_decision_ms < y->mean_decision_ms ? -1 : 1; } return (x->misfire_rate > y->misfire_rate) - (x->misfire_rate < y->misfire_rate); }
+void evaluate_tune_point(const Recording *recs, int rec_count, const Settings *point, TuneResult *result) {
+    int r; long long decision_us; settings = point; memset(result, 0, sizeof(*result));
+    for (r = 0; r < rec_count; ++r) { GestureLabel got = replay_recording(&recs[r], &decision_us); if (got != recs[r].label) { result->misfires++; } else if (got != GESTURE_NONE) { result->decided++; result->decision_us_sum += decision_us; } }
+}
+int run_tune(const char *manifest_path, double max_misfire_rate) {
+    int rec_count = 0, r, w, axis; long i;
+    Recording *recs = load_tune_corpus(manifest_path, &rec_count);
+    if (recs == NULL || rec_count == 0) { fprintf(stderr, "[ERROR] No usable recordings in \"%s\".\n", manifest_path); return EXIT_FAILURE; }
+    int per_label[GESTURE_LABEL_COUNT] = {0}; for (r = 0; r < rec_count; ++r) { per_label[recs[r].label]++; }
+    long grid_size = 1; for (axis = 0; axis < TUNE_AXIS_COUNT; ++axis) { grid_size *= tune_axes[axis].count; }
+    long workers = sysconf(_SC_NPROCESSORS_ONLN); if (workers < 1) { workers = 1; } if (workers > grid_size) { workers = grid_size; }
+    printf("[TUNE] %d recordings (", rec_count); for (r = 0; r < GESTURE_LABEL_COUNT; ++r) { printf("%s%s=%d", r ? " " : "", GESTURE_LABEL_NAMES[r], per_label[r]); } printf("), %ld settings, %ld workers\n", grid_size, workers); fflush(stdout);
+    TuneResult *results = mmap(NULL, (size_t)(grid_size + 1) * sizeof(TuneResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) { perror("[ERROR] Cannot map tuning results"); return EXIT_FAILURE; }
+    long long start_ns = monotonic_ns(); Settings point; const Settings *base = settings; // The grid varies the loaded config, or the defaults
+    io_backend = &io_backend_classify;
+    pid_t *pids = calloc((size_t)workers, sizeof(pid_t)); int failed = 0, status;
+    if (pids == NULL) { perror("[ERROR] Out of memory"); return EXIT_FAILURE; }
+    for (w = 0; w < workers; ++w) {
+        pid_t pid = fork();
+        if (pid == -1) { perror("[ERROR] fork"); failed = 1; break; }
+        if (pid == 0) { // Worker: strided share of the grid; the gesture engine's [INFO] lines are discarded
+            if (freopen("/dev/null", "w", stdout) == NULL) { _exit(1); }
+            for (i = w; i <= grid_size; i += workers) { if (i == grid_size) { point = *base; } else { tune_settings_for_index(base, i, &point); } evaluate_tune_point(recs, rec_count, &point, &results[i]); } // Slot grid_size: reference run with the defaults
+            _exit(0);
+        }
+        pids[w] = pid;
+    }
+    for (w = 0; w < workers; ++w) { // A worker that didn't finish left its share of results[] zeroed, which would read as perfect
+        if (pids[w] == 0) { continue; }
+        while (waitpid(pids[w], &status, 0) == -1 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { fprintf(stderr, "[ERROR] Tuning worker %d %s %d.\n", w, WIFSIGNALED(status) ? "was killed by signal" : "exited with status", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)); failed = 1; }
+    }
+    free(pids);
+    if (failed) { fprintf(stderr, "[ERROR] Part of the grid was not evaluated; no ranking reported.\n"); return EXIT_FAILURE; }
+    double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+
+    TuneRanked *ranked = malloc((size_t)grid_size * sizeof(TuneRanked)); long feasible = 0;
+    if (ranked == NULL) { perror("[ERROR] Out of memory"); return EXIT_FAILURE; }
+    for (i = 0; i < grid_size; ++i) { double rate = results[i].misfires / (double)rec_count; if (rate <= max_misfire_rate) { ranked[feasible].index = i; ranked[feasible].misfire_rate = rate; ranked[feasible].decided = results[i].decided; ranked[feasible].mean_decision_ms = results[i].decided ? results[i].decision_us_sum / 1000.0 / results[i].decided : 0.0; feasible++; } }
+    qsort(ranked, (size_t)feasible, sizeof(TuneRanked), compare_tune_ranked);
+    const TuneResult *def = &results[grid_size];
+    printf("[TUNE] Evaluated %ld settings x %d recordings in %.2f s\n", grid_size, rec_count, elapsed_s);
+    printf("[TUNE] defaults: misfire=%.1f%% decision=%.1f ms\n", 100.0 * def->misfires / rec_count, def->decided ? def->decision_us_sum / 1000.0 / def->decided : 0.0);
+    if (feasible == 0) { printf("[TUNE] No setting keeps misfires at or below %.1f%%.\n", 100.0 * max_misfire_rate); free(ranked); return EXIT_FAILURE; }
+    printf("[TUNE] %ld settings keep misfires <= %.1f%%; fastest first:\n", feasible, 100.0 * max_misfire_rate);
+    for (i = 0; i < feasible && i < 10; ++i) { printf("[TUNE] #%ld misfire=%.1f%% ", i + 1, 100.0 * ranked[i].misfire_rate); if (ranked[i].decided) { printf("decision=%.1f ms:", ranked[i].mean_decision_ms); } else { printf("decision=n/a (no gesture recognised):"); } print_tune_settings(ranked[i].index); printf("\n"); }
+    free(ranked);
+    return EXIT_SUCCESS;
+}
+
+// --- Main Function ---
+// SIGINT/SIGTERM stop the loop so cleanup runs (buttons released, device ungrabbed, stats printed); SIGUSR1 prints the profile.
+volatile sig_atomic_t stop_requested = 0;
+void handle_signal(int sig) { if (sig == SIGUSR1) { profile_dump_requested = 1; } else { stop_requested = 1; } }
+int main(int argc, char *argv[]) {
+    int evdev_fd = -1; int uinput_fd = -1; struct input_event ev; struct input_event in_events[EVENT_BATCH_MAX]; unsigned char merge_frame[EVENT_BATCH_MAX]; int open_frame_pure = 0; int held = 0;
+    int grab = 1; char *device_path = NULL; int needs_sync = 0; int bench_io = 0; int passthrough_reported_count = 0;
+    const char *record_path = NULL; const char *tune_manifest = NULL; double tune_max_misfire = 0.05; int profiling = 0;
+    int i, k;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--watch-state") == 0) { return watch_shm_state(); }
+        else if (strncmp(argv[i], "--io=", 5) == 0) { io_backend = select_io_backend(argv[i] + 5); if (io_backend == NULL) { fprintf(stderr, "[ERROR] Unknown I/O backend \"%s\" (expected read, uring or uring-sqpoll).\n", argv[i] + 5); return EXIT_FAILURE; } }
+        else if (strcmp(argv[i], "--bench-io") == 0) { bench_io = 1; }
+        else if (strcmp(argv[i], "--mode=gestures") == 0) { output_mode = OUTPUT_MODE_GESTURES; }
+        else if (strcmp(argv[i], "--mode=passthrough") == 0) { output_mode = OUTPUT_MODE_PASSTHROUGH; }
+        else if (strcmp(argv[i], "--mode=absolute") == 0) { output_mode = OUTPUT_MODE_ABSOLUTE; }
+        else if (strncmp(argv[i], "--desktop=", 10) == 0) { if (parse_abs_rect(argv[i] + 10, &abs_desktop, 0) == -1) { fprintf(stderr, "[ERROR] Bad --desktop \"%s\" (expected WxH).\n", argv[i] + 10); return EXIT_FAILURE; } }
+        else if (strncmp(argv[i], "--target=", 9) == 0) { if (abs_target_count == ABS_TARGET_MAX || parse_abs_rect(argv[i] + 9, &abs_targets[abs_target_count], 1) == -1) { fprintf(stderr, "[ERROR] Bad --target \"%s\" (expected WxH+X+Y, at most %d).\n", argv[i] + 9, ABS_TARGET_MAX); return EXIT_FAILURE; } abs_target_count++; }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) { record_path = argv[++i]; }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) { replay_path = argv[++i]; }
+        else if (strcmp(argv[i], "--profile") == 0) { profiling = 1; }
+        else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) { config_path = argv[++i]; }
+        else if (strcmp(argv[i], "--tune") == 0 && i + 1 < argc) { tune_manifest = argv[++i]; }
+        else if (strncmp(argv[i], "--max-misfire=", 14) == 0) { tune_max_misfire = atof(argv[i] + 14) / 100.0; }
+        else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) { if (parse_tune_grid(argv[++i]) == -1) { fprintf(stderr, "[ERROR] Bad --grid \"%s\" (expected key=v1,v2,... with key one of move, drag_start, tap_one, tap_two, tap_ms, tap_two_ms, double_tap_ms, pinch, long_press_ms).\n", argv[i]); return EXIT_FAILURE; } }
+        else { fprintf(stderr, "Usage: %s [--config FILE] [--mode=gestures|passthrough|absolute] [--desktop=WxH] [--target=WxH+X+Y ...] [--io=read|uring|uring-sqpoll] [--record FILE | --replay FILE] [--profile] [--bench-io] [--watch-state]\n       %s [--config FILE] --tune MANIFEST [--max-misfire=PERCENT] [--grid key=v1,v2,...]...\n", argv[0], argv[0]); return EXIT_FAILURE; }
+    }
+    if (bench_io) { return run_io_benchmark(); }
+    if (abs_target_count == 0) { abs_targets[0] = abs_desktop; abs_target_count = 1; } // Whole desktop
+    for (k = 0; k < abs_target_count; ++k) { const AbsRect *t = &abs_targets[k]; if (t->x + t->w > abs_desktop.w || t->y + t->h > abs_desktop.h) { fprintf(stderr, "[ERROR] Target %dx%d+%d+%d lies outside the %dx%d desktop (set --desktop).\n", t->w, t->h, t->x, t->y, abs_desktop.w, abs_desktop.h); return EXIT_FAILURE; } }
+    if (config_path != NULL) {
+        Settings *loaded = malloc(sizeof(Settings)); if (loaded == NULL) { perror("[ERROR] Out of memory"); return EXIT_FAILURE; }
+        if (load_settings_file(config_path, loaded, config_device_name, sizeof(config_device_name)) == -1) { free(loaded); return EXIT_FAILURE; }
+        settings = loaded; if (config_device_name[0]) { TARGET_DEVICE_NAME = config_device_name; }
+        printf("[INFO] Loaded settings from %s\n", config_path);
+    }
+    if (tune_manifest != NULL) { return run_tune(tune_manifest, tune_max_misfire); }
+    if (replay_path != NULL && (record_path != NULL || output_mode != OUTPUT_MODE_GESTURES)) { fprintf(stderr, "[ERROR] --replay works in gestures mode only and cannot be combined with --record.\n"); return EXIT_FAILURE; }
+    struct sigaction sa; memset(&sa, 0, sizeof(sa)); sa.sa_handler = handle_signal; sigemptyset(&sa.sa_mask); // No SA_RESTART: a blocked read must return EINTR
+    sigaction(SIGINT, &sa, NULL); sigaction(SIGTERM, &sa, NULL); if (profiling) { sigaction(SIGUSR1, &sa, NULL); }
 
     // Initialize state
-    memset(&gesture_state, 0, sizeof(GestureState));
-    for (i = 0; i < MAX_SLOTS; ++i) { gesture_state.slots[i].tracking_id = -1; }
+    reset_gesture_state(); palm_filter_reset();
 
     printf("Starting C Unified Touch Handler (V3.10 - Logs Cleaned)...\n"); // Version indication
     printf("!!! This program must be run with root privileges (sudo).\n");
     printf("!!! Touchscreen input will be GRABBED.\n");
 
-    // 1. Find the evdev device path
-    device_path = find_device_path_by_name(TARGET_DEVICE_NAME);
-    if (device_path == NULL) { return EXIT_FAILURE; }
+    if (replay_path != NULL) { io_backend = &io_backend_replay; printf("[INFO] Replay mode: the touchscreen is left alone.\n"); } else {
+        // 1. Find the evdev device path
+        device_path = find_device_path_by_name(TARGET_DEVICE_NAME);
+        if (device_path == NULL) { return EXIT_FAILURE; }
 
-    // 2. Open and Grab the evdev device
-    evdev_fd = open(device_path, O_RDONLY | O_NONBLOCK);
-    if (evdev_fd == -1) { fprintf(stderr, "[ERROR] Cannot open evdev device \"%s\": %s\n", device_path, strerror(errno)); goto cleanup; }
-    if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[ERROR] Cannot grab evdev device"); goto cleanup; }
-    printf("[INFO] Successfully grabbed evdev device: %s\n", device_path);
+        // 2. Open and Grab the evdev device
+        evdev_fd = open(device_path, O_RDONLY | O_NONBLOCK);
+        if (evdev_fd == -1) { fprintf(stderr, "[ERROR] Cannot open evdev device \"%s\": %s\n", device_path, strerror(errno)); goto cleanup; }
+        if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[ERROR] Cannot grab evdev device"); goto cleanup; }
+        printf("[INFO] Successfully grabbed evdev device: %s\n", device_path);
+        int clock_id = CLOCK_MONOTONIC; // Event timestamps and gesture deadlines must share a clock that doesn't jump
+        if (ioctl(evdev_fd, EVIOCSCLOCKID, &clock_id) == -1) { fprintf(stderr, "[WARN] Cannot switch evdev timestamps to CLOCK_MONOTONIC (%s); using CLOCK_REALTIME.\n", strerror(errno)); engine_clock = CLOCK_REALTIME; }
+        if (ioctl(evdev_fd, EVIOCGABS(ABS_MT_POSITION_X), &src_abs_x) == -1 || ioctl(evdev_fd, EVIOCGABS(ABS_MT_POSITION_Y), &src_abs_y) == -1) { perror("[ERROR] Cannot query ABS_MT_POSITION ranges"); goto cleanup; }
+        printf("[INFO] Touch area: X %d..%d (res %d), Y %d..%d (res %d)\n", src_abs_x.minimum, src_abs_x.maximum, src_abs_x.resolution, src_abs_y.minimum, src_abs_y.maximum, src_abs_y.resolution);
+        if (ioctl(evdev_fd, EVIOCGABS(ABS_MT_TOUCH_MAJOR), &src_abs_major) == -1) { memset(&src_abs_major, 0, sizeof(src_abs_major)); } // Optional axes: palm rules that need them stay off
+        if (ioctl(evdev_fd, EVIOCGABS(ABS_MT_PRESSURE), &src_abs_pressure) == -1) { memset(&src_abs_pressure, 0, sizeof(src_abs_pressure)); }
+        if (ioctl(evdev_fd, EVIOCGABS(ABS_MT_TOOL_TYPE), &src_abs_tool) == -1) { memset(&src_abs_tool, 0, sizeof(src_abs_tool)); }
+        printf("[INFO] Palm rejection inputs: touch major %d..%d (res %d), pressure %d..%d, tool type %s\n", src_abs_major.minimum, src_abs_major.maximum, src_abs_major.resolution, src_abs_pressure.minimum, src_abs_pressure.maximum, source_has_axis(&src_abs_tool) ? "yes" : "no");
+    }
 
     // 3. Setup the virtual uinput device (for Move, LClick, RClick)
     uinput_fd = setup_uinput_device();
     if (uinput_fd == -1) { fprintf(stderr, "[FATAL] Failed to setup uinput device. Exiting.\n"); goto cleanup; }
+    if (io_backend == &io_backend_replay && io_backend->init(evdev_fd, uinput_fd) == -1) { goto cleanup; }
+    else if (io_backend != &io_backend_replay && io_backend->init(evdev_fd, uinput_fd) == -1) { fprintf(stderr, "[WARN] I/O backend '%s' unavailable, falling back to '%s'.\n", io_backend->name, io_backend_read.name); io_backend = &io_backend_read; io_backend->init(evdev_fd, uinput_fd); }
+    printf("[INFO] Using I/O backend: %s\n", io_backend->name); profile_emit_queued_only = (io_backend == &io_backend_uring);
+    shm_state = shm_state_create(); // Optional: failure only disables the export
+    if (record_path != NULL) { record_fd = open(record_path, O_WRONLY | O_CREAT | O_APPEND, 0644); if (record_fd == -1) { fprintf(stderr, "[ERROR] Cannot open recording \"%s\": %s\n", record_path, strerror(errno)); goto cleanup; } printf("[INFO] Recording raw events to %s\n", record_path); }
     printf("[INFO] Waiting 1 second for udev...\n");
     sleep(1);
 
-    printf("[INFO] Ready. 1F Tap=LClick, 1F Swipe=Move, 1F DblTap+Hold+Swipe=Drag, 2F Tap=RClick. Ctrl+C=Exit.\n");
+    if (output_mode == OUTPUT_MODE_PASSTHROUGH) { printf("[INFO] Ready. Passthrough mode: MT frames forwarded to the virtual touchpad (gestures by libinput). Ctrl+C=Exit.\n"); }
+    else if (output_mode == OUTPUT_MODE_ABSOLUTE) { printf("[INFO] Ready. Absolute mode: 1F Touch=Warp cursor to the mapped spot, 1F Tap=LClick, 1F DblTap+Hold+Swipe=Drag, 2F Tap=RClick. Ctrl+C=Exit.\n"); }
+    else { printf("[INFO] Ready. 1F Tap=LClick, 1F Swipe=Move, 1F DblTap+Hold+Swipe=Drag, 2F Tap=RClick. Ctrl+C=Exit.\n"); }
+    if (profiling && profile_open() == -1) { goto cleanup; }
+    if (config_path != NULL) { config_watch_start(); } // Optional: failure only disables live reload
 
     // 4. Main Event Loop
-    while (1) {
-        n = read(evdev_fd, &ev, sizeof(struct input_event));
-        if (n == (ssize_t)-1) { if (errno == EINTR) continue; if (errno == EWOULDBLOCK) { if (needs_sync) { if(send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { needs_sync = 0; } } usleep(10000); continue; } else { perror("\n[ERROR] Error reading events from evdev device"); break; } }
-        else if (n == 0 || n != sizeof(struct input_event)) { fprintf(stderr, "\n[WARN] Read %ld bytes (expected %ld). Ignoring.\n", n, sizeof(struct input_event)); continue; }
-
-        // --- Process Multi-Touch Event ---
-        int finger_lifted_slot = -1;
-        int previous_finger_count = gesture_state.active_finger_count; // Store count before processing event
-
-        // --- Optional: Log raw event for debugging ---
-        // printf("Event: time %ld.%06ld, type %u (%s), code %u (%s), value %d\n",
-        //        ev.time.tv_sec, (long)ev.time.tv_usec, ev.type, get_event_type_str(ev.type),
-        //        ev.code, get_code_str(ev.type, ev.code), ev.value);
-
-
-        switch (ev.type) {
-            case EV_ABS:
-                switch (ev.code) {
-                    case ABS_MT_SLOT: if (ev.value >= 0 && ev.value < MAX_SLOTS) { gesture_state.current_slot = ev.value; } break;
-                    case ABS_MT_TRACKING_ID:
-                        if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS) {
-                            int current_id = gesture_state.slots[gesture_state.current_slot].tracking_id; int new_id = ev.value;
-                            // printf("  [DEBUG] TRACKING_ID: Slot=%d, Value=%d (CurrentID=%d)\n", gesture_state.current_slot, new_id, current_id);
-                            if (current_id != -1 && new_id == -1) { // Finger lifted
-                                if (gesture_state.slots[gesture_state.current_slot].active) {
-                                    finger_lifted_slot = gesture_state.current_slot; // Record which slot lifted
-                                    // printf("    [DEBUG] Finger Up: Slot=%d, ID=%d. Active Count was: %d\n", finger_lifted_slot, current_id, previous_finger_count);
-
-                                    // ★★★ Perform Tap/Drag Release Checks HERE ★★★
-
-                                    // --- Two-Finger Tap Check ---
-                                    if (gesture_state.potential_two_finger_tap && previous_finger_count == 2) {
-                                         // printf("    [2F_TAP_DEBUG] Checking Tap for lifted slot %d\n", finger_lifted_slot);
-                                         struct timeval ct; gettimeofday(&ct, NULL); long dur = timeval_diff_ms(&gesture_state.two_finger_touch_time, &ct); int moved = 0;
-                                         long long dx_l = (long long)gesture_state.slots[finger_lifted_slot].x - (long long)gesture_state.slots[finger_lifted_slot].start_x; long long dy_l = (long long)gesture_state.slots[finger_lifted_slot].y - (long long)gesture_state.slots[finger_lifted_slot].start_y; if ((dx_l*dx_l + dy_l*dy_l) > DEAD_ZONE_THRESHOLD_SQ_TAP_TWO) { moved = 1; /*printf("      [2F_TAP_DEBUG] Lifted slot moved: dist_sq=%lld\n", (dx_l*dx_l + dy_l*dy_l));*/ }
-                                         if (!moved) { for(i=0; i<MAX_SLOTS; ++i) { if(i != finger_lifted_slot && gesture_state.slots[i].active) { long long dx_o = (long long)gesture_state.slots[i].x - (long long)gesture_state.slots[i].start_x; long long dy_o = (long long)gesture_state.slots[i].y - (long long)gesture_state.slots[i].start_y; if ((dx_o*dx_o + dy_o*dy_o) > DEAD_ZONE_THRESHOLD_SQ_TAP_TWO) { moved = 1; /*printf("      [2F_TAP_DEBUG] Other slot %d moved: dist_sq=%lld\n", i, (dx_o*dx_o + dy_o*dy_o));*/ break; } } } }
-                                         // printf("      [2F_TAP_DEBUG] Final Check: Duration=%ld ms (Timeout=%ld), Moved=%d\n", dur, TAP_TIMEOUT_MS_TWO, moved);
-                                         if (dur < TAP_TIMEOUT_MS_TWO && !moved ) { printf("[INFO] Two-Finger Tap detected! Sending Right Click.\n"); send_uinput_event(uinput_fd, EV_KEY, BTN_RIGHT, 1); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); usleep(20000); send_uinput_event(uinput_fd, EV_KEY, BTN_RIGHT, 0); needs_sync = 1; }
-                                         gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0;
-                                         // printf("      [DEBUG] Reset 2F flags after check.\n");
-                                    }
-
-                                    // --- Single-Finger Tap/Drag Release Check ---
-                                    if (previous_finger_count == 1) { // Check if the finger lifted was the *only* finger
-                                         // printf("    [1F_TAP_DEBUG] Checking Single Tap/Drag Release for lifted slot %d\n", finger_lifted_slot);
-                                         struct timeval current_time; gettimeofday(&current_time, NULL); long duration_ms = timeval_diff_ms(&gesture_state.touch_down_time_single, &current_time);
-                                         long long dx_1f = (long long)gesture_state.slots[finger_lifted_slot].x - (long long)gesture_state.slots[finger_lifted_slot].start_x; long long dy_1f = (long long)gesture_state.slots[finger_lifted_slot].y - (long long)gesture_state.slots[finger_lifted_slot].start_y;
-                                         int moved_1f = (dx_1f * dx_1f + dy_1f * dy_1f) > DEAD_ZONE_THRESHOLD_SQ_TAP_ONE; // Use TAP_ONE threshold
-                                         // printf("      [1F_TAP_DEBUG] Check: PotentialTap=%d, MovedCheck=%d (DistSq=%lld, Thresh=%d), DragActive=%d, Duration=%ld ms\n", gesture_state.potential_single_tap, moved_1f, (dx_1f*dx_1f + dy_1f*dy_1f), DEAD_ZONE_THRESHOLD_SQ_TAP_ONE, gesture_state.drag_active, duration_ms);
-                                         if (gesture_state.potential_single_tap && !moved_1f && !gesture_state.drag_active && duration_ms < TAP_TIMEOUT_MS_SINGLE) { printf("[INFO] Single Tap detected! Sending Left Click.\n"); send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 1); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); usleep(20000); send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); needs_sync = 1; }
-                                         else if (gesture_state.drag_active) { printf("[INFO] Drag End (1F). Releasing Left Button.\n"); send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); needs_sync = 1; }
-                                         // Reset flags after processing lift
-                                         gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.drag_active = 0; gesture_state.is_moving = 0;
-                                         gesture_state.last_touch_up_time = current_time; // Record time for double tap check
-                                         // printf("      [DEBUG] Reset 1F flags. last_touch_up_time set.\n");
-                                    }
-
-                                    // Update state *after* all checks for the lifted finger
-                                    gesture_state.slots[finger_lifted_slot].active = 0;
-                                    gesture_state.slots[finger_lifted_slot].tracking_id = -1;
-                                    gesture_state.active_finger_count--;
-                                }
-                            } else if (current_id == -1 && new_id != -1) { // New finger down
-                                if(gesture_state.current_slot < MAX_SLOTS && !gesture_state.slots[gesture_state.current_slot].active) {
-                                    gesture_state.slots[gesture_state.current_slot].active = 1; gesture_state.slots[gesture_state.current_slot].tracking_id = new_id; gesture_state.slots[gesture_state.current_slot].x = 0; gesture_state.slots[gesture_state.current_slot].y = 0; gesture_state.slots[gesture_state.current_slot].start_x = 0; gesture_state.slots[gesture_state.current_slot].start_y = 0; gesture_state.slots[gesture_state.current_slot].last_x = 0; gesture_state.slots[gesture_state.current_slot].last_y = 0; gesture_state.active_finger_count++;
-                                    // printf("    [DEBUG] Finger Down: Slot=%d, ID=%d. Active Count: %d\n", gesture_state.current_slot, new_id, gesture_state.active_finger_count);
-                                    struct timeval current_time; gettimeofday(&current_time, NULL);
-                                    if (gesture_state.active_finger_count == 1) { /*printf("    [DEBUG] State: 1 Finger Down\n");*/ gesture_state.touch_down_time_single = current_time; gesture_state.potential_single_tap = 1; gesture_state.is_moving = 0; gesture_state.drag_active = 0; long time_since_last_up = timeval_diff_ms(&gesture_state.last_touch_up_time, &current_time); if (time_since_last_up < DOUBLE_TAP_TIMEOUT_MS) { gesture_state.potential_drag_start = 1; /*printf("      [DEBUG] Potential Drag Start set (time since up: %ld ms)\n", time_since_last_up);*/ } else { gesture_state.potential_drag_start = 0; } gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0; }
-                                    else if (gesture_state.active_finger_count == 2) { /*printf("    [DEBUG] State: 2 Fingers Down\n");*/ gesture_state.potential_two_finger_tap = 1; gettimeofday(&gesture_state.two_finger_touch_time, NULL); gesture_state.two_finger_start_coords_set = 0; gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.drag_active = 0; gesture_state.is_moving = 0; }
-                                    else { /*printf("    [DEBUG] State: %d Fingers Down - Resetting gestures\n", gesture_state.active_finger_count);*/ gesture_state.potential_single_tap = 0; gesture_state.potential_drag_start = 0; gesture_state.potential_two_finger_tap = 0; gesture_state.drag_active = 0; gesture_state.is_moving = 0; }
-                                }
-                            }
-                        } break; // End ABS_MT_TRACKING_ID
-                    case ABS_MT_POSITION_X: if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS && gesture_state.slots[gesture_state.current_slot].active) { gesture_state.slots[gesture_state.current_slot].x = ev.value; } break;
-                    case ABS_MT_POSITION_Y: if (gesture_state.current_slot >= 0 && gesture_state.current_slot < MAX_SLOTS && gesture_state.slots[gesture_state.current_slot].active) { gesture_state.slots[gesture_state.current_slot].y = ev.value; } break;
-                } break; // End EV_ABS
-
-            case EV_SYN:
-                if (ev.code == SYN_REPORT) {
-                    // printf("  [DEBUG] SYN_REPORT - Active Fingers: %d\n", gesture_state.active_finger_count);
-                    int current_active_finger_count = gesture_state.active_finger_count;
-
-                    // Set Start Coords
-                    if (gesture_state.potential_two_finger_tap && current_active_finger_count == 2 && !gesture_state.two_finger_start_coords_set) { /*printf("    [DEBUG] Recording 2F start coords on SYN report:\n");*/ for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { gesture_state.slots[i].start_x = gesture_state.slots[i].x; gesture_state.slots[i].start_y = gesture_state.slots[i].y; /*printf("      Slot %d Start: X=%d, Y=%d\n", i, gesture_state.slots[i].start_x, gesture_state.slots[i].start_y);*/ } } gesture_state.two_finger_start_coords_set = 1; }
-                    if (current_active_finger_count == 1) { int active_slot = -1; for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { active_slot = i; break; } } if (active_slot != -1 && gesture_state.slots[active_slot].last_x == 0 && gesture_state.slots[active_slot].last_y == 0 && !gesture_state.is_moving && !gesture_state.drag_active) { gesture_state.slots[active_slot].start_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].start_y = gesture_state.slots[active_slot].y; gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y; /*printf("    [DEBUG] Recording 1F start/last coords: Slot=%d, X=%d, Y=%d\n", active_slot, gesture_state.slots[active_slot].start_x, gesture_state.slots[active_slot].start_y);*/ } }
-
-                    // --- Tap/Drag Release Checks Moved to TRACKING_ID ---
-
-                    // --- Single-Finger Movement Logic ---
-                    if (current_active_finger_count == 1) {
-                        int active_slot = -1; for(i=0; i<MAX_SLOTS; ++i) { if(gesture_state.slots[i].active) { active_slot = i; break; } }
-                        if (active_slot != -1) {
-                            long long dist_x = (long long)gesture_state.slots[active_slot].x - (long long)gesture_state.slots[active_slot].start_x; long long dist_y = (long long)gesture_state.slots[active_slot].y - (long long)gesture_state.slots[active_slot].start_y; long long dist_sq = dist_x * dist_x + dist_y * dist_y;
-                            int threshold_to_use = gesture_state.potential_drag_start ? DEAD_ZONE_THRESHOLD_SQ_DRAG_START : DEAD_ZONE_THRESHOLD_SQ_MOVE;
-                            if (!gesture_state.is_moving && !gesture_state.drag_active && dist_sq > threshold_to_use) {
-                                // printf("    [MOVE_DEBUG] Dead zone exceeded (Slot %d): dist_sq=%lld, threshold=%d\n", active_slot, dist_sq, threshold_to_use);
-                                gesture_state.is_moving = 1;
-                                // Tap potential is checked on lift, not cancelled here
-                                if (gesture_state.potential_drag_start) { printf("[INFO] Drag Start (1F DoubleTap+Hold+Swipe)\n"); send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 1); needs_sync = 1; gesture_state.drag_active = 1; gesture_state.potential_drag_start = 0; gesture_state.potential_single_tap = 0; }
-                                gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y;
-                            }
-                            if (gesture_state.is_moving || gesture_state.drag_active) {
-                                int delta_abs_x = gesture_state.slots[active_slot].x - gesture_state.slots[active_slot].last_x; int delta_abs_y = gesture_state.slots[active_slot].y - gesture_state.slots[active_slot].last_y; int dx_rel = 0; int dy_rel = 0;
-                                if (delta_abs_x != 0 || delta_abs_y != 0) {
-                                     dx_rel = (int)round((double)(delta_abs_y) * SENSITIVITY); dy_rel = (int)round((double)(-delta_abs_x) * SENSITIVITY);
-                                     // printf("    [MOVE_DEBUG] Slot %d Delta: dX_abs=%d, dY_abs=%d -> dX_rel=%d, dY_rel=%d\n", active_slot, delta_abs_x, delta_abs_y, dx_rel, dy_rel);
-                                     if (dx_rel != 0) { send_uinput_event(uinput_fd, EV_REL, REL_X, dx_rel); needs_sync = 1; }
-                                     if (dy_rel != 0) { send_uinput_event(uinput_fd, EV_REL, REL_Y, dy_rel); needs_sync = 1; }
-                                     gesture_state.slots[active_slot].last_x = gesture_state.slots[active_slot].x; gesture_state.slots[active_slot].last_y = gesture_state.slots[active_slot].y;
-                                }
-                            }
-                        }
-                    }
+    // Stop/dump signals stay blocked while the loop runs and are let in only inside the backend's wait (ppoll / io_uring_enter
+    // sigmask), so one arriving between the stop_requested check and the wait still interrupts that wait.
+    sigset_t loop_signals, wait_mask; sigemptyset(&loop_signals); sigaddset(&loop_signals, SIGINT); sigaddset(&loop_signals, SIGTERM); sigaddset(&loop_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &loop_signals, &wait_mask); io_wait_sigmask = &wait_mask;
+    while (!stop_requested) {
+        if (profile_dump_requested) { profile_dump_requested = 0; profile_print(); }
+        long long next_deadline = timer_next_deadline_us(); long long timeout_us = -1; // Sleep until input or the next gesture deadline
+        if (next_deadline >= 0) { timeout_us = next_deadline - engine_clock_now_us(); if (timeout_us < 0) { timeout_us = 0; } }
+        int count = io_backend->read_events(in_events + held, EVENT_BATCH_MAX - held, timeout_us); // After a partial frame held back by the palm filter
+        if (count == -1) { if (errno == EINTR) continue; if (errno == ENODATA && io_backend == &io_backend_replay) { printf("[INFO] Replay finished.\n"); errno = 0; break; } perror("\n[ERROR] Error reading events from evdev device"); break; }
+        if (record_fd >= 0 && write(record_fd, in_events + held, (size_t)count * sizeof(struct input_event)) == -1) { perror("[WARN] Recording write failed, recording stopped"); close(record_fd); record_fd = -1; }
 
-                    // Send sync to uinput if needed
-                    if (needs_sync) { if(send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { needs_sync = 0; } }
-                    // Reset potential flags based on current count
-                    if(current_active_finger_count != 2 && gesture_state.potential_two_finger_tap) { gesture_state.potential_two_finger_tap = 0; gesture_state.two_finger_start_coords_set = 0; }
-                    if(current_active_finger_count != 1 && gesture_state.potential_single_tap) { gesture_state.potential_single_tap = 0;}
+        count += held; held = 0;
+        if (output_mode != OUTPUT_MODE_PASSTHROUGH) { profile_switch(PROFILE_DECODE); count = palm_filter_batch(in_events, count, &held); } // libinput does its own in passthrough mode
+        if (output_mode != OUTPUT_MODE_PASSTHROUGH && coalesce_mark_frames(in_events, count, merge_frame, &open_frame_pure) > 1) { backlog_batches++; }
 
-                } // end if SYN_REPORT
-                break; // End EV_SYN
-        } // End switch(ev.type)
+        for (k = 0; k < count; ++k) {
+            ev = in_events[k];
+            profile_switch(ev.type == EV_SYN ? PROFILE_GESTURE : PROFILE_DECODE); if (ev.type == EV_SYN && ev.code == SYN_REPORT) { profile.frames++; }
+            if (output_mode == OUTPUT_MODE_PASSTHROUGH) { passthrough_event(uinput_fd, &ev, &passthrough_reported_count); }
+            else {
+                gesture_run_timers(uinput_fd, timeval_us(&ev.time), &needs_sync); // Deadlines that passed before this event was generated
+                if (merge_frame[k] && gesture_state_is_pure_motion()) { coalesced_frames++; continue; } // Stale motion frame: folded into the next one
+                gesture_event(uinput_fd, &ev, &needs_sync);
+            }
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT && __atomic_load_n(&pending_settings, __ATOMIC_RELAXED) != NULL) { settings_apply_pending(); } // Frame boundary
+        } // End for (batch)
+        if (held) { memmove(in_events, &in_events[count], (size_t)held * sizeof(struct input_event)); }
+        if (output_mode != OUTPUT_MODE_PASSTHROUGH) { gesture_run_timers(uinput_fd, io_backend == &io_backend_replay ? engine_now_us : engine_clock_now_us(), &needs_sync); } // A replay runs on recorded time
+        // Frames normally end with SYN_REPORT above; flush anything still pending once the batch is drained
+        if (needs_sync) { if(send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0) == 0) { needs_sync = 0; } }
+        profile_switch(PROFILE_IDLE);
     } // End while
 
 cleanup:
     // 5. Cleanup resources
     printf("\n[INFO] Cleaning up...\n");
-    if (uinput_fd >= 0 && gesture_state.drag_active) { send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); }
+    if (uinput_fd >= 0 && (gesture_state.drag_active || gesture_state.drag_locked)) { send_uinput_event(uinput_fd, EV_KEY, BTN_LEFT, 0); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); }
+    if (uinput_fd >= 0 && gesture_state.pinch_active) { send_uinput_event(uinput_fd, EV_KEY, KEY_LEFTCTRL, 0); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); }
+    if (uinput_fd >= 0 && timer_deadline_us[TIMER_CLICK_RELEASE]) { send_uinput_event(uinput_fd, EV_KEY, click_release_button, 0); send_uinput_event(uinput_fd, EV_SYN, SYN_REPORT, 0); }
+    if (profiling) { profile_print(); profile_close(); }
+    config_watch_stop();
+    if (contacts_rejected[CONTACT_PALM] + contacts_rejected[CONTACT_GHOST] + contacts_rejected[CONTACT_EDGE]) { printf("[INFO] Rejected contacts: %llu palm, %llu ghost, %llu edge (%llu after touch-down); %llu events dropped.\n", contacts_rejected[CONTACT_PALM], contacts_rejected[CONTACT_GHOST], contacts_rejected[CONTACT_EDGE], contacts_rejected_late, palm_dropped_events); }
+    if (backlog_batches) { printf("[INFO] Backlog seen in %llu reads; %llu stale motion frames coalesced.\n", backlog_batches, coalesced_frames); }
+    if (uinput_fd >= 0) { io_backend->flush(); print_io_stats(); io_backend->destroy(); }
     destroy_uinput_device(uinput_fd);
+    shm_state_destroy(shm_state);
+    if (record_fd >= 0) { close(record_fd); }
     if (evdev_fd >= 0) { grab = 0; if (ioctl(evdev_fd, EVIOCGRAB, &grab) == -1) { perror("[WARN] Failed to ungrab evdev device"); } else { printf("[INFO] Evdev device ungrabbed.\n"); } if (close(evdev_fd) == -1) { perror("[WARN] Failed to close evdev device file descriptor"); } }
     if (device_path != NULL) { free(device_path); }
     printf("[INFO] Exiting MT handler.\n");